@@ -0,0 +1,57 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <tuple>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "kls/phttp/Message.h"
+#include "kls/thread/SpinLock.h"
+
+namespace kls::phttp::detail {
+    // a value per key for up to limit keys, every key past the limit shares one overflow value
+    // values are created in place from the arguments given at construction and are never moved afterwards
+    template<class V, class... Args>
+    class BoundedTable {
+    public:
+        explicit BoundedTable(size_t limit, Args... args) :
+                m_limit(limit), m_args(std::move(args)...), m_overflow(std::make_from_tuple<V>(m_args)) {}
+
+        V &get(std::string_view key) {
+            std::lock_guard lk{m_lock};
+            if (auto it = m_table.find(key); it != m_table.end()) return it->second;
+            if (m_table.size() >= m_limit) return m_overflow;
+            return std::apply([&](const auto &... args) -> V & {
+                return m_table.try_emplace(std::string(key), args...).first->second;
+            }, m_args);
+        }
+    private:
+        size_t m_limit;
+        std::tuple<Args...> m_args;
+        V m_overflow;
+        thread::SpinLock m_lock{};
+        std::unordered_map<std::string, V, StringHash, std::equal_to<>> m_table{};
+    };
+}
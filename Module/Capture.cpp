@@ -0,0 +1,319 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <cstdio>
+#include <memory>
+#include <cstring>
+#include <system_error>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "Timer.h"
+#include "kls/phttp/Error.h"
+#include "kls/phttp/Capture.h"
+#include "kls/coroutine/Future.h"
+
+using namespace kls::io;
+using namespace kls::phttp;
+using namespace kls::coroutine;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    // a capture is the magic followed by records of: time (int64), direction (int32), block id, size and content
+    constexpr char Magic[8] = {'p', 'h', 't', 't', 'p', 'c', 'a', 'p'};
+    constexpr int32_t RecordHeaderSize = 20;
+    constexpr int32_t ShutdownId = -1;
+
+    class CaptureEndpoint : public Endpoint {
+    public:
+        CaptureEndpoint(std::unique_ptr<Endpoint> endpoint, const std::string &path) :
+                m_endpoint(std::move(endpoint)), m_path(path), m_file(std::fopen(path.c_str(), "wb")),
+                m_start(Clock::now()) {
+            if (!m_file) throw std::system_error(errno, std::generic_category(), path);
+            try { write(Magic, sizeof(Magic)); }
+            catch (...) {
+                std::fclose(m_file);
+                throw;
+            }
+        }
+
+        ~CaptureEndpoint() override { std::fclose(m_file); }
+
+        [[nodiscard]] Peer peer() const noexcept override { return m_endpoint->peer(); }
+
+        [[nodiscard]] const Limits &limits() const noexcept override { return m_endpoint->limits(); }
+
+        [[nodiscard]] std::optional<SocketOptions> socket_options() const override {
+            return m_endpoint->socket_options();
+        }
+
+        ValueAsync<> put(Block block) override {
+            record(Direction::Outbound, block.id(), block.content());
+            return m_endpoint->put(std::move(block));
+        }
+
+        ValueAsync<> put_slice(int32_t id, kls::Span<> content) override {
+            record(Direction::Outbound, id, content);
+            return m_endpoint->put_slice(id, content);
+        }
+
+        ValueAsync<> put_buffer(const OutputBuffer &buffer) override {
+            for (auto &&block: buffer.blocks()) record(Direction::Outbound, block.id, block.content);
+            return m_endpoint->put_buffer(buffer);
+        }
+
+        ValueAsync<Block> get() override {
+            auto block = co_await m_endpoint->get();
+            record(Direction::Inbound, block.id(), block.content());
+            co_return block;
+        }
+
+        // the connection is closed even if the capture could not be completed, the failure is reported after
+        ValueAsync<> close() override {
+            bool flushed{};
+            {
+                std::lock_guard lk{m_lock};
+                flushed = std::fflush(m_file) == 0;
+            }
+            const auto error = errno;
+            co_await m_endpoint->close();
+            if (!flushed) throw std::system_error(error, std::generic_category(), m_path);
+        }
+    private:
+        std::unique_ptr<Endpoint> m_endpoint;
+        std::string m_path;
+        std::mutex m_lock{};
+        std::FILE *m_file;
+        Clock::time_point m_start;
+
+        void record(Direction direction, int32_t id, kls::Span<> content) {
+            char header[RecordHeaderSize];
+            const auto size = int32_t(content.end() - content.begin());
+            auto access = kls::essential::Access<std::endian::little>{{header, RecordHeaderSize}};
+            std::lock_guard lk{m_lock};
+            access.put<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count());
+            access.put<int32_t>(8, int32_t(direction));
+            access.put<int32_t>(12, id);
+            access.put<int32_t>(16, size);
+            write(header, RecordHeaderSize);
+            write(content.begin(), size_t(size));
+        }
+
+        // a short write leaves a truncated capture behind, so it fails the operation that was being recorded
+        void write(const void *data, size_t size) {
+            if (std::fwrite(data, 1, size, m_file) != size)
+                throw std::system_error(errno, std::generic_category(), m_path);
+        }
+    };
+
+    class MappedCapture : public CaptureFile {
+    public:
+        explicit MappedCapture(const std::string &path) {
+            map(path);
+            try { index(); }
+            catch (...) {
+                unmap();
+                throw;
+            }
+        }
+
+        ~MappedCapture() override { unmap(); }
+
+        [[nodiscard]] std::span<const CaptureRecord> records() const noexcept override { return m_records; }
+    private:
+        char *m_data{nullptr};
+        size_t m_size{0};
+        std::vector<CaptureRecord> m_records{};
+#if defined(_WIN32)
+        HANDLE m_mapping{nullptr};
+
+        void map(const std::string &path) {
+            const auto fail = [&]() { throw std::system_error(int(GetLastError()), std::system_category(), path); };
+            auto file = CreateFileA(
+                    path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                    nullptr
+            );
+            if (file == INVALID_HANDLE_VALUE) fail();
+            LARGE_INTEGER size{};
+            if (!GetFileSizeEx(file, &size)) CloseHandle(file), fail();
+            if (size_t(size.QuadPart) < sizeof(Magic)) CloseHandle(file), throw MalformedBlock();
+            m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            CloseHandle(file);
+            if (!m_mapping) fail();
+            m_data = static_cast<char *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (!m_data) CloseHandle(m_mapping), fail();
+            m_size = size_t(size.QuadPart);
+        }
+
+        void unmap() noexcept {
+            UnmapViewOfFile(m_data);
+            CloseHandle(m_mapping);
+        }
+#else
+        void map(const std::string &path) {
+            const auto fail = [&]() { throw std::system_error(errno, std::generic_category(), path); };
+            const auto file = ::open(path.c_str(), O_RDONLY);
+            if (file < 0) fail();
+            struct stat status{};
+            if (fstat(file, &status)) ::close(file), fail();
+            if (size_t(status.st_size) < sizeof(Magic)) ::close(file), throw MalformedBlock();
+            auto data = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+            ::close(file);
+            if (data == MAP_FAILED) fail();
+            madvise(data, size_t(status.st_size), MADV_SEQUENTIAL);
+            m_data = static_cast<char *>(data);
+            m_size = size_t(status.st_size);
+        }
+
+        void unmap() noexcept { munmap(m_data, m_size); }
+#endif
+
+        void index() {
+            if (std::memcmp(m_data, Magic, sizeof(Magic)) != 0) throw MalformedBlock();
+            for (size_t offset = sizeof(Magic); offset < m_size;) {
+                if (m_size - offset < RecordHeaderSize) throw MalformedBlock();
+                const auto access = kls::essential::Access<std::endian::little>{{m_data + offset, RecordHeaderSize}};
+                const auto direction = access.get<int32_t>(8);
+                const auto size = access.get<int32_t>(16);
+                if ((direction != 0 && direction != 1) || size < 0) throw MalformedBlock();
+                if (m_size - offset - RecordHeaderSize < size_t(size)) throw MalformedBlock();
+                m_records.push_back(CaptureRecord{
+                        .time = std::chrono::nanoseconds(access.get<int64_t>(0)),
+                        .direction = Direction(direction),
+                        .id = access.get<int32_t>(12),
+                        .content = {m_data + offset + RecordHeaderSize, size}
+                });
+                offset += RecordHeaderSize + size_t(size);
+            }
+        }
+    };
+
+    // index of the first data block of the direction at or after index, control blocks are not replayed
+    size_t next_record(std::span<const CaptureRecord> records, size_t index, Direction direction) noexcept {
+        while (index < records.size() && (records[index].direction != direction || records[index].id < 0)) ++index;
+        return index;
+    }
+
+    class Pacer {
+    public:
+        explicit Pacer(ReplaySpeed speed):
+                m_timer(speed == ReplaySpeed::Original ? std::make_unique<kls::phttp::detail::Timer>() : nullptr) {}
+
+        // completes once the record is due, the first record is due at once. the wait is left to the timer thread
+        // and the caller resumes on a worker, so no executor thread is held while pacing
+        ValueAsync<> wait(std::chrono::nanoseconds time) {
+            if (!m_timer) co_return;
+            if (!m_started) {
+                m_started = true;
+                m_origin = time;
+                m_start = Clock::now();
+                co_return;
+            }
+            const auto at = m_start + std::chrono::duration_cast<Clock::duration>(time - m_origin);
+            if (at <= Clock::now()) co_return;
+            co_await ValueFuture<void>([&](auto promise) { m_timer->schedule(at, [promise]() { promise->set(); }); });
+            co_await Redispatch{};
+        }
+    private:
+        std::unique_ptr<kls::phttp::detail::Timer> m_timer;
+        bool m_started{false};
+        std::chrono::nanoseconds m_origin{};
+        Clock::time_point m_start{};
+    };
+
+    class ReplayEndpoint : public Endpoint {
+    public:
+        ReplayEndpoint(const CaptureFile &capture, Direction direction, ReplaySpeed speed):
+                m_records(capture.records()), m_direction(direction), m_pacer(speed) {}
+
+        [[nodiscard]] Peer peer() const noexcept override { return {Address::CreateIPv4("0.0.0.0").value(), 0}; }
+
+        ValueAsync<> put(Block) override { co_return; }
+
+        ValueAsync<> put_slice(int32_t, kls::Span<>) override { co_return; }
+
+        ValueAsync<> put_buffer(const OutputBuffer &) override { co_return; }
+
+        ValueAsync<Block> get() override {
+            auto memory = kls::pmr::default_resource();
+            m_next = next_record(m_records, m_next, m_direction);
+            if (m_next == m_records.size()) co_return Block(0, ShutdownId, memory);
+            const auto &record = m_records[m_next++];
+            co_await m_pacer.wait(record.time);
+            auto block = Block(int32_t(record.content.end() - record.content.begin()), record.id, memory);
+            std::copy(record.content.begin(), record.content.end(), block.content().begin());
+            co_return block;
+        }
+
+        ValueAsync<> close() override { co_return; }
+    private:
+        std::span<const CaptureRecord> m_records;
+        Direction m_direction;
+        Pacer m_pacer;
+        size_t m_next{0};
+    };
+
+    ValueAsync<int64_t> receive_until_shutdown(Endpoint &target) {
+        for (int64_t received = 0;; ++received) {
+            auto block = co_await target.get();
+            if (block.id() < 0) co_return received;
+        }
+    }
+}
+
+namespace kls::phttp {
+    std::unique_ptr<Endpoint> capture(std::unique_ptr<Endpoint> endpoint, const std::string &path) {
+        return std::make_unique<CaptureEndpoint>(std::move(endpoint), path);
+    }
+
+    std::unique_ptr<CaptureFile> open_capture(const std::string &path) {
+        return std::make_unique<MappedCapture>(path);
+    }
+
+    std::unique_ptr<Endpoint> replay_endpoint(const CaptureFile &capture, Direction direction, ReplaySpeed speed) {
+        return std::make_unique<ReplayEndpoint>(capture, direction, speed);
+    }
+
+    // captured blocks are put straight from the mapping, the peer's blocks are counted and dropped
+    coroutine::ValueAsync<ReplayResult> replay(
+            const CaptureFile &capture, Direction direction, Endpoint &target, ReplaySpeed speed
+    ) {
+        const auto start = Clock::now();
+        const auto records = capture.records();
+        auto received = receive_until_shutdown(target);
+        auto pacer = Pacer(speed);
+        int64_t sent = 0;
+        for (size_t i = 0; (i = next_record(records, i, direction)) < records.size(); ++i, ++sent) {
+            co_await pacer.wait(records[i].time);
+            co_await target.put_slice(records[i].id, records[i].content);
+        }
+        co_await target.put(Block(0, ShutdownId, pmr::default_resource()));
+        const auto count = co_await std::move(received);
+        co_return ReplayResult{.sent = sent, .received = count, .elapsed = Clock::now() - start};
+    }
+}
@@ -26,4 +26,8 @@ namespace kls::phttp {
     const char *InconsistentState::what() const noexcept {
         return "Inconsistent State for kls::phttp Client/Server";
     }
+
+    const char *MalformedBlock::what() const noexcept {
+        return "Malformed Block Received By kls::phttp Client/Server";
+    }
 }
\ No newline at end of file
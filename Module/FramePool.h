@@ -0,0 +1,191 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <new>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <cstddef>
+#include <coroutine>
+#include "kls/coroutine/Async.h"
+
+namespace kls::phttp::detail {
+    // recycles coroutine frames per thread in size classes, so that steady state traffic does not hit the global heap
+    // every frame carries a header naming the pool it came from, frames released on another thread are handed back
+    // to that pool through a lock-free return list that the owning thread drains when its own list runs empty
+    class FramePool {
+        static constexpr size_t granularity = 64;
+        static constexpr size_t classes = 32;
+        static constexpr size_t depth = 256;
+
+        struct Node { Node *next; };
+
+        struct Owner {
+            // touched by the owning thread only
+            Node *heads[classes]{};
+            size_t counts[classes]{};
+            // frames released by other threads
+            std::atomic<Node *> returned{nullptr};
+            // one for the owning thread and one per frame handed out, the last one frees the pool
+            std::atomic<size_t> refs{1};
+            std::atomic<bool> alive{true};
+        };
+
+        struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header {
+            Owner *owner;
+            uint32_t index;
+        };
+
+        static Header *header_of(void *frame) noexcept { return static_cast<Header *>(frame) - 1; }
+
+        static void free_list(Node *node) noexcept {
+            while (node) ::operator delete(header_of(std::exchange(node, node->next)));
+        }
+
+        static void unpin(Owner *owner) noexcept {
+            if (owner->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            free_list(owner->returned.exchange(nullptr, std::memory_order_acquire));
+            delete owner;
+        }
+
+        struct Local {
+            Owner *owner{new Owner{}};
+
+            ~Local() noexcept {
+                owner->alive.store(false);
+                for (auto head: owner->heads) free_list(head);
+                free_list(owner->returned.exchange(nullptr));
+                destroyed() = true;
+                unpin(owner);
+            }
+        };
+
+        static bool &destroyed() noexcept {
+            thread_local bool value{false};
+            return value;
+        }
+
+        static Owner *current() noexcept {
+            if (destroyed()) return nullptr;
+            thread_local Local value{};
+            return value.owner;
+        }
+
+        static std::atomic<size_t> &fresh() noexcept {
+            static std::atomic<size_t> value{0};
+            return value;
+        }
+
+        // moves the frames other threads handed back into the local lists
+        static void reclaim(Owner *owner) noexcept {
+            auto node = owner->returned.exchange(nullptr, std::memory_order_acquire);
+            while (node) {
+                auto next = node->next;
+                const auto index = header_of(node)->index;
+                if (owner->counts[index] < depth) {
+                    owner->heads[index] = new(node) Node{owner->heads[index]};
+                    ++owner->counts[index];
+                }
+                else
+                    ::operator delete(header_of(node));
+                node = next;
+            }
+        }
+
+        static void *pop(Owner *owner, size_t index) noexcept {
+            auto node = owner->heads[index];
+            if (!node) return nullptr;
+            owner->heads[index] = node->next;
+            --owner->counts[index];
+            return node;
+        }
+    public:
+        [[nodiscard]] static void *allocate(size_t size) {
+            const auto index = (size - 1) / granularity;
+            const auto owner = index < classes ? current() : nullptr;
+            if (!owner) {
+                auto header = static_cast<Header *>(::operator new(sizeof(Header) + size));
+                *header = Header{nullptr, 0};
+                return header + 1;
+            }
+            auto frame = pop(owner, index);
+            if (!frame && owner->returned.load(std::memory_order_relaxed)) {
+                reclaim(owner);
+                frame = pop(owner, index);
+            }
+            if (!frame) {
+                auto header = static_cast<Header *>(::operator new(sizeof(Header) + (index + 1) * granularity));
+                *header = Header{owner, uint32_t(index)};
+                fresh().fetch_add(1, std::memory_order_relaxed);
+                frame = header + 1;
+            }
+            owner->refs.fetch_add(1, std::memory_order_relaxed);
+            return frame;
+        }
+
+        static void release(void *frame, size_t) noexcept {
+            const auto header = header_of(frame);
+            const auto owner = header->owner;
+            if (!owner) return ::operator delete(header);
+            if (owner == current()) {
+                const auto index = header->index;
+                if (owner->counts[index] < depth) {
+                    owner->heads[index] = new(frame) Node{owner->heads[index]};
+                    ++owner->counts[index];
+                }
+                else
+                    ::operator delete(header);
+                owner->refs.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+            // the frame keeps its owner alive until it has been handed back
+            auto node = new(frame) Node{owner->returned.load(std::memory_order_relaxed)};
+            while (!owner->returned.compare_exchange_weak(node->next, node)) {}
+            if (!owner->alive.load()) free_list(owner->returned.exchange(nullptr, std::memory_order_acquire));
+            unpin(owner);
+        }
+
+        // number of frames that had to be taken from the global heap since the start of the process
+        [[nodiscard]] static size_t fresh_allocations() noexcept { return fresh().load(std::memory_order_relaxed); }
+    };
+
+    template<class T>
+    struct PooledPromise : coroutine::ValueAsync<T>::promise_type {
+        using coroutine::ValueAsync<T>::promise_type::promise_type;
+
+        [[nodiscard]] static void *operator new(size_t size) { return FramePool::allocate(size); }
+
+        static void operator delete(void *frame, size_t size) noexcept { FramePool::release(frame, size); }
+    };
+
+    // specialize as true for a class to allocate the frames of its member coroutines from the FramePool
+    template<class Self>
+    inline constexpr bool pooled_frames = false;
+}
+
+template<class T, class Self, class... Args>
+requires kls::phttp::detail::pooled_frames<Self>
+struct std::coroutine_traits<kls::coroutine::ValueAsync<T>, Self &, Args...> {
+    using promise_type = kls::phttp::detail::PooledPromise<T>;
+};
@@ -0,0 +1,244 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+#include "Timer.h"
+#include "BoundedTable.h"
+#include "kls/phttp/Hedging.h"
+#include "kls/thread/SpinLock.h"
+#include "kls/coroutine/Future.h"
+
+using namespace kls::phttp;
+using namespace kls::thread;
+using namespace kls::coroutine;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    // the most recent latencies of a verb and resource
+    class LatencyWindow {
+    public:
+        explicit LatencyWindow(int32_t size) : m_samples(size_t(std::max(size, 1))) {}
+
+        void record(Clock::duration latency) noexcept {
+            std::lock_guard lk{m_lock};
+            m_samples[m_next] = latency.count();
+            m_next = (m_next + 1) % m_samples.size();
+            m_count = std::min(m_count + 1, m_samples.size());
+        }
+
+        [[nodiscard]] std::optional<Clock::duration> percentile(double percent, int32_t min_samples) const {
+            std::vector<Clock::rep> samples{};
+            {
+                std::lock_guard lk{m_lock};
+                if (m_count < size_t(std::max(min_samples, 1))) return std::nullopt;
+                samples.assign(m_samples.begin(), m_samples.begin() + ptrdiff_t(m_count));
+            }
+            const auto rank = std::min(samples.size() - 1, size_t(percent / 100.0 * double(samples.size())));
+            std::nth_element(samples.begin(), samples.begin() + ptrdiff_t(rank), samples.end());
+            return Clock::duration(samples[rank]);
+        }
+    private:
+        mutable SpinLock m_lock{};
+        std::vector<Clock::rep> m_samples;
+        size_t m_next{0}, m_count{0};
+    };
+
+    // the copies of one request in flight, settled by the first response or by the last failure
+    struct Race {
+        SpinLock lock{};
+        bool settled{false};
+        int pending{0};
+        std::optional<ValueFuture<Response>::PromiseHandle> promise{};
+        // the duplicate to send if the request is hedged
+        std::optional<Request> backup{};
+        LatencyWindow *window{nullptr};
+    };
+
+    class HedgingImpl : public HedgingClient {
+    public:
+        HedgingImpl(std::vector<std::unique_ptr<ClientEndpoint>> peers, HedgingOptions options) :
+                m_peers(std::move(peers)), m_options(std::move(options)), m_windows(1024, m_options.window) {}
+
+        ValueAsync<Response> exec(Request request) override {
+            m_requests.fetch_add(1, std::memory_order_relaxed);
+            const auto primary = next_peer();
+            if (m_peers.size() < 2 || !is_idempotent(request)) return m_peers[primary]->exec(std::move(request));
+            return exec_hedged(std::move(request), primary);
+        }
+
+        ValueAsync<std::vector<ValueAsync<Response>>> exec_batch(std::span<Request> requests) override {
+            std::vector<ValueAsync<Response>> responses{};
+            responses.reserve(requests.size());
+            for (auto &&request: requests) responses.push_back(exec(std::move(request)));
+            co_return std::move(responses);
+        }
+
+        ValueAsync<> notify(Request request) override { return m_peers[next_peer()]->notify(std::move(request)); }
+
+        ValueAsync<> close() override {
+            RelayTable final{};
+            {
+                std::lock_guard lk{m_relay_lock};
+                m_is_down = true;
+                final = std::move(m_relays);
+            }
+            for (auto&&[k, v]: final) co_await std::move(v);
+            for (auto &&peer: m_peers) co_await peer->close();
+        }
+
+        [[nodiscard]] HedgingStats stats() const noexcept override {
+            return HedgingStats{
+                    .requests = m_requests.load(std::memory_order_relaxed),
+                    .hedged = m_hedged.load(std::memory_order_relaxed),
+                    .hedge_wins = m_hedge_wins.load(std::memory_order_relaxed)
+            };
+        }
+    private:
+        std::vector<std::unique_ptr<ClientEndpoint>> m_peers;
+        HedgingOptions m_options;
+        std::atomic<size_t> m_next{0};
+        std::atomic<int64_t> m_requests{0}, m_hedged{0}, m_hedge_wins{0};
+        // recent latencies per verb and resource
+        kls::phttp::detail::BoundedTable<LatencyWindow, int32_t> m_windows;
+        // copies in flight, each erases its own entry when done
+        using RelayTable = std::unordered_map<uint64_t, ValueAsync<>>;
+        SpinLock m_relay_lock{};
+        bool m_is_down{false};
+        uint64_t m_top_relay{0};
+        RelayTable m_relays{};
+        // destroyed first, so that no callback runs once the rest is gone
+        kls::phttp::detail::Timer m_timer{};
+
+        size_t next_peer() noexcept { return m_next.fetch_add(1, std::memory_order_relaxed) % m_peers.size(); }
+
+        [[nodiscard]] bool is_idempotent(const Request &request) const noexcept {
+            if (!m_options.idempotent_header.empty() && !request.headers.get(m_options.idempotent_header).empty())
+                return true;
+            const auto &verbs = m_options.idempotent_verbs;
+            return std::find(verbs.begin(), verbs.end(), request.line.verb()) != verbs.end();
+        }
+
+        LatencyWindow &window_for(const RequestLine &line) {
+            return m_windows.get(std::string(line.verb()).append(1, ' ').append(line.resource()));
+        }
+
+        [[nodiscard]] Clock::duration delay_for(const LatencyWindow &window) const {
+            const auto observed = window.percentile(m_options.percentile, m_options.min_samples);
+            const auto delay = observed ? *observed : std::chrono::duration_cast<Clock::duration>(m_options.initial_delay);
+            return std::max(delay, std::chrono::duration_cast<Clock::duration>(m_options.min_delay));
+        }
+
+        [[nodiscard]] bool within_budget() const noexcept {
+            const auto requests = double(m_requests.load(std::memory_order_relaxed));
+            return double(m_hedged.load(std::memory_order_relaxed)) < m_options.max_hedge_ratio * requests;
+        }
+
+        ValueAsync<Response> exec_hedged(Request request, size_t primary) {
+            auto memory = kls::pmr::default_resource();
+            auto race = std::make_shared<Race>();
+            race->window = &window_for(request.line);
+            race->backup = request.clone(memory);
+            race->pending = 1;
+            auto result = ValueFuture<Response>([&](auto promise) { race->promise = promise; });
+            const auto at = Clock::now() + delay_for(*race->window);
+            start_relay(race, primary, std::move(request), false);
+            m_timer.schedule(at, [this, race, secondary = (primary + 1) % m_peers.size()]() {
+                hedge(race, secondary);
+            });
+            co_return co_await result;
+        }
+
+        // runs on the timer thread
+        void hedge(const std::shared_ptr<Race> &race, size_t secondary) {
+            if (!within_budget()) return;
+            std::optional<Request> request{};
+            {
+                std::lock_guard lk{race->lock};
+                if (race->settled) return;
+                request = std::move(race->backup);
+                race->backup.reset();
+                ++race->pending;
+            }
+            m_hedged.fetch_add(1, std::memory_order_relaxed);
+            start_relay(race, secondary, std::move(*request), true);
+        }
+
+        // a relay waits at its gate until its entry is in the table. the check of is_down and the entry are made
+        // under one lock, so close() always finds a task it can wait for, never a placeholder
+        void start_relay(std::shared_ptr<Race> race, size_t peer, Request request, bool hedged) {
+            std::optional<ValueFuture<void>::PromiseHandle> gate{};
+            bool is_down{};
+            {
+                std::lock_guard lk{m_relay_lock};
+                is_down = m_is_down;
+                if (!is_down) {
+                    const auto key = m_top_relay++;
+                    m_relays.insert({key, relay(key, std::move(race), peer, std::move(request), hedged, gate)});
+                }
+            }
+            if (is_down) return finish(*race, false, std::nullopt, std::make_exception_ptr(ChannelClosed()));
+            (*gate)->set();
+        }
+
+        ValueAsync<> relay(uint64_t key, std::shared_ptr<Race> race, size_t peer, Request request, bool hedged,
+                           std::optional<ValueFuture<void>::PromiseHandle> &gate) {
+            co_await ValueFuture<void>([&](auto promise) { gate = promise; });
+            // duplicates are started from the timer thread, which must not be held up by sending
+            if (hedged) co_await Redispatch{};
+            const auto start = Clock::now();
+            std::optional<Response> response{};
+            std::exception_ptr error{};
+            try {
+                response = co_await m_peers[peer]->exec(std::move(request));
+                race->window->record(Clock::now() - start);
+            }
+            catch (...) { error = std::current_exception(); }
+            finish(*race, hedged, std::move(response), error);
+            std::lock_guard lk{m_relay_lock};
+            m_relays.erase(key);
+        }
+
+        void finish(Race &race, bool hedged, std::optional<Response> response, const std::exception_ptr &error) {
+            ValueFuture<Response>::PromiseHandle promise = *race.promise;
+            {
+                std::lock_guard lk{race.lock};
+                --race.pending;
+                if (race.settled || (!response && race.pending > 0)) return;
+                race.settled = true;
+            }
+            if (!response) return promise->fail(error);
+            if (hedged) m_hedge_wins.fetch_add(1, std::memory_order_relaxed);
+            promise->set(std::move(*response));
+        }
+    };
+}
+
+namespace kls::phttp {
+    std::unique_ptr<HedgingClient> HedgingClient::create(
+            std::vector<std::unique_ptr<ClientEndpoint>> peers, HedgingOptions options
+    ) {
+        return std::make_unique<HedgingImpl>(std::move(peers), std::move(options));
+    }
+}
@@ -20,7 +20,7 @@
 * SOFTWARE.
 */
 
-#include <numeric>
+#include "kls/phttp/Error.h"
 #include "kls/phttp/Message.h"
 
 namespace kls::phttp {
@@ -33,42 +33,93 @@ namespace kls::phttp {
             std::copy(view.begin(), view.end(), writer.bytes(size).begin());
         }
 
-        static std::string_view unpack_phttp_string(essential::SpanReader<Endian> &reader) {
-            auto length = reader.get<int32_t>();
-            auto span = reader.bytes(length);
-            return {span.begin(), span.end()};
-        }
+        // validates every length against the remaining content while decoding, so a block is checked in the same
+        // single pass that decodes it
+        class CheckedReader {
+        public:
+            explicit CheckedReader(Span<> span) noexcept: m_reader(span), m_remain(span.end() - span.begin()) {}
+
+            [[nodiscard]] int32_t get_int32() {
+                take(4);
+                return m_reader.get<int32_t>();
+            }
+
+            [[nodiscard]] int32_t get_count(int32_t max_count, int32_t min_entry_size) {
+                const auto count = get_int32();
+                if (count < 0 || count > max_count || int64_t(count) * min_entry_size > m_remain)
+                    throw MalformedBlock();
+                return count;
+            }
+
+            [[nodiscard]] std::string_view get_string() {
+                const auto length = get_int32();
+                if (length < 0) throw MalformedBlock();
+                take(length);
+                auto span = m_reader.bytes(length);
+                return {span.begin(), span.end()};
+            }
+
+            void finish() const { if (m_remain) throw MalformedBlock(); }
+        private:
+            essential::SpanReader<Endian> m_reader;
+            int64_t m_remain;
+
+            void take(int64_t size) {
+                if (size > m_remain) throw MalformedBlock();
+                m_remain -= size;
+            }
+        };
     }
 
-    Block RequestLine::pack(int32_t id, pmr::MemoryResource *memory) const {
-        auto block = Block(int32_t(m_verb.size() + m_version.size() + m_resource.size() + 12), id, memory);
-        auto writer = essential::SpanWriter<Endian>(block.content());
+    int32_t RequestLine::packed_size() const noexcept {
+        return int32_t(m_verb.size() + m_version.size() + m_resource.size() + 12);
+    }
+
+    void RequestLine::pack_into(essential::SpanWriter<Endian> &writer) const noexcept {
         detail::pack_phttp_string(writer, m_verb);
         detail::pack_phttp_string(writer, m_version);
         detail::pack_phttp_string(writer, m_resource);
+    }
+
+    Block RequestLine::pack(int32_t id, pmr::MemoryResource *memory) const {
+        auto block = Block(packed_size(), id, memory);
+        auto writer = essential::SpanWriter<Endian>(block.content());
+        pack_into(writer);
         return block;
     }
 
     RequestLine RequestLine::unpack(const Block& block, pmr::MemoryResource *memory) {
-        essential::SpanReader<Endian> reader{block.content()};
-        auto verb = alias::string(detail::unpack_phttp_string(reader), {memory});
-        auto version = alias::string(detail::unpack_phttp_string(reader), {memory});
-        auto resource = alias::string(detail::unpack_phttp_string(reader), {memory});
+        detail::CheckedReader reader{block.content()};
+        auto verb = alias::string(reader.get_string(), {memory});
+        auto version = alias::string(reader.get_string(), {memory});
+        auto resource = alias::string(reader.get_string(), {memory});
+        reader.finish();
         return {std::move(verb), std::move(version), std::move(resource)};
     }
 
-    Block ResponseLine::pack(int32_t id, pmr::MemoryResource *memory) const {
-        auto block = Block(int32_t(8 + m_message.size()), id, memory);
-        auto writer = essential::SpanWriter<Endian>(block.content());
+    RequestLine RequestLine::clone(pmr::MemoryResource *memory) const {
+        return {alias::string(m_verb, {memory}), alias::string(m_version, {memory}), alias::string(m_resource, {memory})};
+    }
+
+    int32_t ResponseLine::packed_size() const noexcept { return int32_t(8 + m_message.size()); }
+
+    void ResponseLine::pack_into(essential::SpanWriter<Endian> &writer) const noexcept {
         writer.put(m_code);
         detail::pack_phttp_string(writer, m_message);
+    }
+
+    Block ResponseLine::pack(int32_t id, pmr::MemoryResource *memory) const {
+        auto block = Block(packed_size(), id, memory);
+        auto writer = essential::SpanWriter<Endian>(block.content());
+        pack_into(writer);
         return block;
     }
 
     ResponseLine ResponseLine::unpack(const Block& block, pmr::MemoryResource *memory) {
-        essential::SpanReader<Endian> reader{block.content()};
-        auto status = reader.get<int32_t>();
-        auto message = alias::string{detail::unpack_phttp_string(reader), {memory}};
+        detail::CheckedReader reader{block.content()};
+        auto status = reader.get_int32();
+        auto message = alias::string{reader.get_string(), {memory}};
+        reader.finish();
         return {status, message};
     }
 
@@ -77,29 +128,68 @@ namespace kls::phttp {
         m_table.insert_or_assign(alias::string{key, {memory}}, alias::string{value, {memory}});
     }
 
-    Block Headers::pack(int32_t id, pmr::MemoryResource *memory) const {
-        auto block = Block(std::accumulate(
-                m_table.begin(), m_table.end(), int32_t(4),
-                [](auto a, auto b) noexcept { return a + b.first.size() + b.second.size() + 8; }
-        ), id, memory);
-        auto writer = essential::SpanWriter<Endian>(block.content());
+    Headers Headers::clone(pmr::MemoryResource *memory) const {
+        Headers result{memory};
+        result.m_table.reserve(m_table.size());
+        for (auto&&[k, v]: m_table) result.set(k, v);
+        return result;
+    }
+
+    int32_t Headers::packed_size() const noexcept {
+        auto size = int32_t(4);
+        for (auto&&[k, v]: m_table) size += int32_t(k.size() + v.size() + 8);
+        return size;
+    }
+
+    void Headers::pack_into(essential::SpanWriter<Endian> &writer) const noexcept {
         writer.put<int32_t>(int32_t(m_table.size()));
         for (auto&&[k, v]: m_table) {
             detail::pack_phttp_string(writer, k);
             detail::pack_phttp_string(writer, v);
         }
+    }
+
+    Block Headers::pack(int32_t id, pmr::MemoryResource *memory) const {
+        auto block = Block(packed_size(), id, memory);
+        auto writer = essential::SpanWriter<Endian>(block.content());
+        pack_into(writer);
         return block;
     }
 
-    Headers Headers::unpack(const Block& block, pmr::MemoryResource *memory) {
+    Headers Headers::unpack(const Block& block, pmr::MemoryResource *memory, int32_t max_count) {
         Headers result{memory};
-        essential::SpanReader<Endian> reader{block.content()};
-        const auto count = reader.get<int32_t>();
+        detail::CheckedReader reader{block.content()};
+        // every entry takes at least the two length prefixes, which bounds the count before anything is allocated
+        const auto count = reader.get_count(max_count, 8);
+        result.m_table.reserve(count);
         for (int i = 0; i < count; ++i) {
-            auto key = detail::unpack_phttp_string(reader);
-            auto value = detail::unpack_phttp_string(reader);
+            auto key = reader.get_string();
+            auto value = reader.get_string();
             result.set(key, value);
         }
+        reader.finish();
+        return result;
+    }
+
+    Request Request::clone(pmr::MemoryResource *memory) const {
+        auto result = Request{
+                .line = line.clone(memory),
+                .headers = headers.clone(memory),
+                .body = body.clone(memory)
+        };
+        result.continuation.reserve(continuation.size());
+        for (auto &&block: continuation) result.continuation.push_back(block.clone(memory));
+        return result;
+    }
+
+    Response Response::clone(pmr::MemoryResource *memory) const {
+        auto result = Response{
+                .line = ResponseLine(line.code(), line.message(), memory),
+                .headers = headers.clone(memory),
+                .body = body.clone(memory)
+        };
+        result.continuation.reserve(continuation.size());
+        for (auto &&block: continuation) result.continuation.push_back(block.clone(memory));
         return result;
     }
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstring>
+#include "kls/phttp/Transport.h"
+
+namespace kls::phttp {
+    char *OutputBuffer::grow(size_t size) {
+        if (m_chunks.empty()) m_chunks.push_back(Chunk{.begin = 0, .end = open_run, .borrowed = nullptr});
+        if (m_size + size > m_capacity) {
+            const auto capacity = std::max(m_size + size, std::max<size_t>(m_capacity * 2, 4096));
+            auto buffer = pmr::make_unique<char[]>(m_memory, capacity);
+            if (m_size) std::memcpy(buffer.get(), m_buffer.get(), m_size);
+            m_buffer = std::move(buffer);
+            m_capacity = capacity;
+        }
+        const auto result = m_buffer.get() + m_size;
+        m_size += size;
+        return result;
+    }
+
+    static void put_header(char *out, int32_t id, int32_t size) noexcept {
+        auto writer = essential::SpanWriter<std::endian::little>({out, 8});
+        writer.put<int32_t>(id);
+        writer.put<int32_t>(size);
+    }
+
+    essential::SpanWriter<std::endian::little> OutputBuffer::append(int32_t id, int32_t size) {
+        const auto out = grow(size_t(size) + 8);
+        put_header(out, id, size);
+        m_entries.push_back(Record{.id = id, .size = size, .offset = m_size - size_t(size), .borrowed = nullptr});
+        return essential::SpanWriter<std::endian::little>({out + 8, size});
+    }
+
+    void OutputBuffer::append_slice(int32_t id, Span<> content) {
+        const auto size = int32_t(content.end() - content.begin());
+        put_header(grow(8), id, size);
+        m_entries.push_back(Record{.id = id, .size = size, .offset = m_size, .borrowed = content.begin()});
+        // the run up to and including the header is closed, the content goes out from where it is
+        m_chunks.back().end = m_size;
+        if (size) m_chunks.push_back(Chunk{.begin = 0, .end = size_t(size), .borrowed = content.begin()});
+        m_chunks.push_back(Chunk{.begin = m_size, .end = open_run, .borrowed = nullptr});
+    }
+
+    void OutputBuffer::clear() noexcept {
+        m_size = 0;
+        m_entries.clear();
+        m_chunks.clear();
+    }
+}
@@ -20,11 +20,22 @@
 * SOFTWARE.
 */
 
+#include "FramePool.h"
+#include "BoundedTable.h"
+#include "RecyclingMap.h"
 #include "kls/phttp/Error.h"
 #include "kls/phttp/Protocol.h"
 #include "kls/coroutine/Mutex.h"
 #include "kls/coroutine/Future.h"
 #include "kls/coroutine/Operation.h"
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <limits>
+#include <iterator>
+#include <algorithm>
+#include <vector>
 #include <unordered_map>
 
 using namespace kls::io;
@@ -34,134 +45,455 @@ using namespace kls::essential;
 using namespace kls::coroutine;
 
 namespace {
+    class Sender;
+    class ClientImpl;
+    class ServerImpl;
+}
+
+// frames of the member coroutines on the request/response path are recycled through the FramePool
+template<> inline constexpr bool kls::phttp::detail::pooled_frames<Sender> = true;
+template<> inline constexpr bool kls::phttp::detail::pooled_frames<ClientImpl> = true;
+template<> inline constexpr bool kls::phttp::detail::pooled_frames<ServerImpl> = true;
+
+namespace {
+    // bit 30 of a message id marks a one-way message, which is never answered
+    constexpr int32_t OneWayFlag = 0x40000000;
+    // bit 29 of a data block id marks that more data blocks of the same message follow
+    constexpr int32_t MoreFlag = 0x20000000;
+    constexpr int32_t IdMask = MoreFlag - 1;
+    // negative ids are control blocks without content
+    constexpr int32_t ShutdownId = -1;
+    constexpr int32_t ShutdownAckId = -2;
+
     struct Message {
         int stage{0};
-        kls::phttp::Block blocks[3];
+        kls::phttp::Block blocks[2];
+        // the first data block is kept apart, most bodies arrive as a single fragment and need no vector
+        kls::phttp::Block body{};
+        // further data blocks in order, as fragmented on the wire
+        std::vector<kls::phttp::Block> more{};
+        int64_t body_size{0};
     };
 
-    Message pack(Request r, int32_t id, kls::pmr::MemoryResource *memory) {
-        r.body.set_id(id);
-        return Message{.blocks = {r.line.pack(id, memory), r.headers.pack(id, memory), std::move(r.body)}};
-    }
+    using StagingTable = kls::phttp::detail::RecyclingMap<int32_t, Message>;
 
-    Message pack(Response r, int32_t id, kls::pmr::MemoryResource *memory) {
-        r.body.set_id(id);
-        return Message{.blocks = {r.line.pack(id, memory), r.headers.pack(id, memory), std::move(r.body)}};
+    // joins the received fragments into one block, only bodies too large for a single block are continued
+    void join_body(Message &m, Block &body, std::vector<Block> &continuation, kls::pmr::MemoryResource *memory) {
+        static constexpr int64_t segment_limit = std::numeric_limits<int32_t>::max() - 8;
+        if (m.more.empty()) {
+            body = std::move(m.body);
+            return;
+        }
+        std::vector<Block> segments{};
+        for (auto left = m.body_size; segments.empty() || left > 0; left -= segments.back().size())
+            segments.push_back(Block(int32_t(std::min(left, segment_limit)), 0, memory));
+        size_t index = 0;
+        int32_t filled = 0;
+        const auto join = [&](const Block &fragment) {
+            const auto content = fragment.content();
+            for (auto it = content.begin(); it != content.end();) {
+                if (filled == segments[index].size()) {
+                    ++index;
+                    filled = 0;
+                }
+                const auto size = std::min<int64_t>(content.end() - it, segments[index].size() - filled);
+                std::copy(it, it + size, segments[index].content().begin() + filled);
+                it += size;
+                filled += int32_t(size);
+            }
+        };
+        join(m.body);
+        for (auto &&fragment: m.more) join(fragment);
+        body = std::move(segments.front());
+        continuation.assign(std::make_move_iterator(segments.begin() + 1), std::make_move_iterator(segments.end()));
     }
 
-    Request unpack_request(Message m, kls::pmr::MemoryResource *memory) {
-        return Request{
+    Request unpack_request(Message m, const Limits &limits, kls::pmr::MemoryResource *memory) {
+        auto request = Request{
                 .line = RequestLine::unpack(m.blocks[0], memory),
-                .headers = Headers::unpack(m.blocks[1], memory),
-                .body = std::move(m.blocks[2])
+                .headers = Headers::unpack(m.blocks[1], memory, limits.max_header_count),
+                .body = {}
         };
+        join_body(m, request.body, request.continuation, memory);
+        return request;
     }
 
-    Response unpack_response(Message m, kls::pmr::MemoryResource *memory) {
-        return Response{
+    Response unpack_response(Message m, const Limits &limits, kls::pmr::MemoryResource *memory) {
+        auto response = Response{
                 .line = ResponseLine::unpack(m.blocks[0], memory),
-                .headers = Headers::unpack(m.blocks[1], memory),
-                .body = std::move(m.blocks[2])
+                .headers = Headers::unpack(m.blocks[1], memory, limits.max_header_count),
+                .body = {}
         };
+        join_body(m, response.body, response.continuation, memory);
+        return response;
     }
 
-    ValueAsync<> locked_send_message(Endpoint &endpoint, Message message, Mutex &mutex) {
-        MutexLock lk = co_await mutex.scoped_lock_async();
-        co_await endpoint.put(std::move(message.blocks[0]));
-        co_await endpoint.put(std::move(message.blocks[1]));
-        co_await endpoint.put(std::move(message.blocks[2]));
+    // stages a received block under its message, returns true and strips the id once the message is complete
+    bool stage_block(StagingTable &staging, Block block, int32_t &id, Message &complete, const Limits &limits) {
+        const bool more = id & MoreFlag;
+        id &= ~MoreFlag;
+        auto stage_it = staging.find(id);
+        if (stage_it == staging.end()) {
+            if (staging.size() >= limits.max_staged_messages) throw MalformedBlock();
+            stage_it = staging.insert({id, Message{}}).first;
+        }
+        auto &message = stage_it->second;
+        if (message.stage < 2) {
+            message.blocks[message.stage++] = std::move(block);
+            return false;
+        }
+        message.body_size += block.size();
+        if (message.body_size > limits.max_body_size) throw MalformedBlock();
+        if (message.stage == 2) {
+            message.body = std::move(block);
+            ++message.stage;
+        }
+        else
+            message.more.push_back(std::move(block));
+        if (more) return false;
+        complete = std::move(message);
+        staging.erase(stage_it);
+        return true;
     }
 
-    ValueAsync<> post_shutdown_user(Endpoint &endpoint, Mutex &mutex) {
-        MutexLock lk = co_await mutex.scoped_lock_async();
-        auto message = Block(0, -1, kls::pmr::default_resource());
-        co_await endpoint.put(std::move(message));
+    template<class T>
+    [[nodiscard]] bool is_single_fragment(const T &message, int32_t fragment_size) noexcept {
+        return message.continuation.empty() && message.body.size() <= fragment_size;
     }
 
-    ValueAsync<> post_shutdown_user_ack(Endpoint &endpoint, Mutex &mutex) {
-        MutexLock lk = co_await mutex.scoped_lock_async();
-        auto message = Block(0, -2, kls::pmr::default_resource());
-        co_await endpoint.put(std::move(message));
-    }
+    // serializes everything put on the connection by the client or server that owns it
+    class Sender {
+    public:
+        explicit Sender(Endpoint &endpoint) noexcept: m_endpoint(endpoint) {}
+
+        // the lock is taken again for every fragment, so a large body interleaves with other messages
+        template<class T>
+        ValueAsync<> send(T message, int32_t id) {
+            const auto fragment_size = m_endpoint.limits().fragment_size;
+            const auto count = message.continuation.size() + 1;
+            size_t block = 0;
+            int32_t offset = 0;
+            for (bool first = true; block < count; first = false) {
+                MutexLock lk = co_await m_mutex.scoped_lock_async();
+                m_buffer.clear();
+                if (first) append_head(message, id);
+                const auto content = (block ? message.continuation[block - 1] : message.body).content();
+                const auto remain = int32_t(content.end() - content.begin()) - offset;
+                const auto size = std::min(remain, fragment_size);
+                const auto ends_block = size == remain;
+                const auto wire_id = (ends_block && block + 1 == count) ? id : (id | MoreFlag);
+                append_data(wire_id, {content.begin() + offset, size});
+                co_await m_endpoint.put_buffer(m_buffer);
+                if (ends_block) ++block, offset = 0; else offset += size;
+            }
+        }
+
+        // messages that fit in a single fragment are put together, the others are sent on their own afterwards
+        template<class T>
+        ValueAsync<> send_batch(std::span<T> messages, std::span<const int32_t> ids) {
+            const auto fragment_size = m_endpoint.limits().fragment_size;
+            {
+                MutexLock lk = co_await m_mutex.scoped_lock_async();
+                m_buffer.clear();
+                for (size_t i = 0; i < messages.size(); ++i) {
+                    if (!is_single_fragment(messages[i], fragment_size)) continue;
+                    append_head(messages[i], ids[i]);
+                    append_data(ids[i], messages[i].body.content());
+                }
+                if (!m_buffer.empty()) co_await m_endpoint.put_buffer(m_buffer);
+            }
+            for (size_t i = 0; i < messages.size(); ++i) {
+                if (!is_single_fragment(messages[i], fragment_size)) co_await send(std::move(messages[i]), ids[i]);
+            }
+        }
+
+        ValueAsync<> post(int32_t control_id) {
+            MutexLock lk = co_await m_mutex.scoped_lock_async();
+            co_await m_endpoint.put(Block(0, control_id, kls::pmr::default_resource()));
+        }
+    private:
+        // contents up to this size are copied into the buffer, larger ones are referenced in place
+        static constexpr int32_t copy_limit = 16 * 1024;
 
-    ValueAsync<> handle_shutdown_user(Endpoint &endpoint, int32_t id, Mutex &mutex) {
-        if (id == -1) co_await post_shutdown_user_ack(endpoint, mutex);
+        Endpoint &m_endpoint;
+        Mutex m_mutex{};
+        OutputBuffer m_buffer{};
+
+        template<class T>
+        void append_head(const T &message, int32_t id) {
+            m_buffer.append_packed(id, message.line);
+            m_buffer.append_packed(id, message.headers);
+        }
+
+        void append_data(int32_t id, kls::Span<> content) {
+            const auto size = int32_t(content.end() - content.begin());
+            if (size > copy_limit) return m_buffer.append_slice(id, content);
+            auto writer = m_buffer.append(id, size);
+            std::copy(content.begin(), content.end(), writer.bytes(size).begin());
+        }
+    };
+
+    int32_t get_one_way_id(std::atomic<int32_t> &top) noexcept {
+        return OneWayFlag | (top.fetch_add(1, std::memory_order_relaxed) & IdMask);
     }
 
     class ClientImpl : public ClientEndpoint {
     public:
-        explicit ClientImpl(std::unique_ptr<Endpoint> endpoint) :
-                m_receive{}, m_endpoint{std::move(endpoint)} {
+        ClientImpl(std::unique_ptr<Endpoint> endpoint, ClientOptions options) :
+                m_receive{}, m_endpoint{std::move(endpoint)}, m_sender{*m_endpoint}, m_options{std::move(options)} {
             m_receive = receive_worker();
         }
 
         ValueAsync<Response> exec(Request request) override {
-            int32_t id{};
-            auto receive = get_receive_session_future(id);
+            return m_options.coalesce ? exec_coalesced(std::move(request)) : exec_direct(std::move(request));
+        }
+
+        ValueAsync<std::vector<ValueAsync<Response>>> exec_batch(std::span<Request> requests) override {
             auto memory = kls::pmr::default_resource();
-            co_await send_message(id, pack(std::move(request), id, memory));
-            co_return unpack_response(co_await receive, memory);
+            auto ids = std::vector<int32_t>(requests.size());
+            auto responses = std::vector<ValueAsync<Response>>{};
+            responses.reserve(requests.size());
+            {
+                std::lock_guard lk{m_sync};
+                if (m_is_down) throw ChannelClosed();
+                for (auto &&id: ids) responses.push_back(receive_response_locked(id = get_free_id_locked(), memory));
+            }
+            try {
+                co_await m_sender.send_batch(requests, std::span<const int32_t>(ids));
+            }
+            catch (...) {
+                fail_requests(ids, std::current_exception());
+                throw;
+            }
+            co_return std::move(responses);
+        }
+
+        ValueAsync<> notify(Request request) override {
+            {
+                std::lock_guard lk{m_sync};
+                if (m_is_down) throw ChannelClosed();
+            }
+            const auto id = get_one_way_id(m_top_one_way_id);
+            co_await m_sender.send(std::move(request), id);
         }
 
         ValueAsync<> close() override {
             co_await uses(*m_endpoint, [this](Endpoint &) { return close_impl(); });
         }
     private:
-        Mutex m_mutex{};
         ValueAsync<> m_receive;
         std::unique_ptr<Endpoint> m_endpoint;
+        Sender m_sender;
+        ClientOptions m_options;
+        // request coalescing, flights are found by the hash of the coalescing parts and then compared in full
+        using FlightWaiters = std::vector<ValueFuture<Response>::PromiseHandle>;
+        struct Flight {
+            // the request of the leader, which is sent from here and compared against by followers
+            Request request;
+            FlightWaiters waiters{};
+        };
+        using FlightTable = std::unordered_multimap<size_t, Flight>;
+        SpinLock m_flight_sync{};
+        FlightTable m_flights{};
         // response sync back
-        using StagingTable = std::unordered_map<int32_t, Message>;
-        using PromiseTable = std::unordered_map<int32_t, ValueFuture<Message>::PromiseHandle>;
+        using PromiseTable = kls::phttp::detail::RecyclingMap<int32_t, ValueFuture<Message>::PromiseHandle>;
         int32_t m_top_id{0};
+        std::atomic<int32_t> m_top_one_way_id{0};
         SpinLock m_sync{};
         bool m_is_down{false};
         PromiseTable m_promises{};
 
+        // R is Request, or const Request & to send a request that stays with the caller
+        template<class R>
+        ValueAsync<Response> exec_direct(R request) {
+            int32_t id{};
+            auto receive = get_receive_session_future(id);
+            auto memory = kls::pmr::default_resource();
+            try {
+                co_await m_sender.send<R>(std::forward<R>(request), id);
+            }
+            catch (...) {
+                std::lock_guard lk{m_sync};
+                m_promises.erase(id);
+                throw;
+            }
+            co_return unpack_response(co_await receive, m_endpoint->limits(), memory);
+        }
+
+        ValueAsync<Response> exec_coalesced(Request request) {
+            const auto hash = coalescing_hash(request);
+            Flight *flight{};
+            {
+                std::unique_lock lk{m_flight_sync};
+                for (auto [it, end] = m_flights.equal_range(hash); it != end; ++it) {
+                    if (!same_coalescing_parts(it->second.request, request)) continue;
+                    auto &waiters = it->second.waiters;
+                    auto follow = ValueFuture<Response>([&](auto promise) { waiters.push_back(promise); });
+                    lk.unlock();
+                    co_return co_await follow;
+                }
+                flight = &m_flights.insert({hash, Flight{.request = std::move(request)}})->second;
+            }
+            try {
+                auto response = co_await exec_direct<const Request &>(flight->request);
+                release_flight(hash, flight, response);
+                co_return response;
+            }
+            catch (...) {
+                fail_flight(hash, flight, std::current_exception());
+                throw;
+            }
+        }
+
+        [[nodiscard]] size_t coalescing_hash(const Request &request) const noexcept {
+            size_t hash = 0;
+            const auto mix = [&hash](std::string_view part) noexcept {
+                hash ^= std::hash<std::string_view>{}(part) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+            };
+            mix(request.line.verb());
+            mix(request.line.resource());
+            for (auto &&name: m_options.coalesce_headers) mix(request.headers.get(name));
+            for_each_body_block(request, [&mix](kls::Span<> content) { mix({content.begin(), content.end()}); });
+            return hash;
+        }
+
+        [[nodiscard]] bool same_coalescing_parts(const Request &a, const Request &b) const noexcept {
+            if (a.line.verb() != b.line.verb() || a.line.resource() != b.line.resource()) return false;
+            for (auto &&name: m_options.coalesce_headers) {
+                if (a.headers.get(name) != b.headers.get(name)) return false;
+            }
+            if (a.continuation.size() != b.continuation.size()) return false;
+            const auto same = [](const Block &x, const Block &y) noexcept {
+                const auto cx = x.content(), cy = y.content();
+                return std::equal(cx.begin(), cx.end(), cy.begin(), cy.end());
+            };
+            if (!same(a.body, b.body)) return false;
+            for (size_t i = 0; i < a.continuation.size(); ++i) {
+                if (!same(a.continuation[i], b.continuation[i])) return false;
+            }
+            return true;
+        }
+
+        template<class Fn>
+        static void for_each_body_block(const Request &request, Fn &&fn) {
+            fn(request.body.content());
+            for (auto &&block: request.continuation) fn(block.content());
+        }
+
+        FlightWaiters take_flight(size_t hash, const Flight *flight) {
+            std::lock_guard lk{m_flight_sync};
+            for (auto [it, end] = m_flights.equal_range(hash); it != end; ++it) {
+                if (&it->second != flight) continue;
+                auto waiters = std::move(it->second.waiters);
+                m_flights.erase(it);
+                return waiters;
+            }
+            return {};
+        }
+
+        // every follower gets its own line and headers, the body blocks are shared with the leader and not copied
+        void release_flight(size_t hash, const Flight *flight, Response &response) {
+            auto memory = kls::pmr::default_resource();
+            for (auto &&waiter: take_flight(hash, flight)) {
+                auto shared = Response{
+                        .line = ResponseLine(response.line.code(), response.line.message(), memory),
+                        .headers = response.headers.clone(memory),
+                        .body = response.body.share()
+                };
+                shared.continuation.reserve(response.continuation.size());
+                for (auto &&block: response.continuation) shared.continuation.push_back(block.share());
+                waiter->set(std::move(shared));
+            }
+        }
+
+        void fail_flight(size_t hash, const Flight *flight, const std::exception_ptr &error) {
+            for (auto &&waiter: take_flight(hash, flight)) waiter->fail(error);
+        }
+
+        int32_t get_free_id_locked() {
+            for (;;) {
+                const auto id = m_top_id;
+                m_top_id = (m_top_id + 1) & IdMask;
+                if (m_promises.find(id) == m_promises.end()) return id;
+            }
+        }
+
         ValueFuture<Message> get_receive_session_future(int32_t &id) {
-            static constexpr int32_t mask = std::numeric_limits<int32_t>::max();
             std::lock_guard lk{m_sync};
             if (m_is_down) throw ChannelClosed();
-            for (;;) {
-                if (m_promises.find(id = (m_top_id++ % mask)) != m_promises.end()) continue;
-                return ValueFuture<Message>([this, id](auto promise) { m_promises.insert({id, promise}); });
-            }
+            id = get_free_id_locked();
+            return ValueFuture<Message>([this, id](auto promise) { m_promises.insert({id, promise}); });
         };
 
+        // registers the promise before the first suspension, so the caller must hold m_sync
+        ValueAsync<Response> receive_response_locked(int32_t id, kls::pmr::MemoryResource *memory) {
+            auto receive = ValueFuture<Message>([this, id](auto promise) { m_promises.insert({id, promise}); });
+            co_return unpack_response(co_await receive, m_endpoint->limits(), memory);
+        }
+
+        void fail_requests(const std::vector<int32_t> &ids, const std::exception_ptr &error) {
+            std::vector<ValueFuture<Message>::PromiseHandle> failed{};
+            {
+                std::lock_guard lk{m_sync};
+                for (auto id: ids) {
+                    if (auto it = m_promises.find(id); it != m_promises.end()) {
+                        failed.push_back(it->second);
+                        m_promises.erase(it);
+                    }
+                }
+            }
+            for (auto &&promise: failed) promise->fail(error);
+        }
+
+        // a broken or malformed connection fails every standing request with its error before ending the loop
         ValueAsync<> receive_worker() {
             StagingTable staging{};
-            for (;;) {
-                auto block = co_await m_endpoint->get();
-                const auto id = block.id();
-                if (id < 0) {
-                    co_await handle_shutdown_user(*m_endpoint, id, m_mutex);
-                    fail_all_standing_requests();
-                    break;
+            try {
+                for (;;) {
+                    auto block = co_await m_endpoint->get();
+                    auto id = block.id();
+                    if (id < 0) {
+                        if (id == ShutdownId) co_await m_sender.post(ShutdownAckId);
+                        fail_all_standing_requests(std::make_exception_ptr(ChannelClosed()));
+                        break;
+                    }
+                    process_incoming_message(staging, std::move(block), id);
                 }
-                process_incoming_message(staging, std::move(block), id);
+            }
+            catch (...) {
+                fail_all_standing_requests(std::current_exception());
+                throw;
             }
         }
 
-        void fail_all_standing_requests() {
+        void fail_all_standing_requests(const std::exception_ptr &error) {
             PromiseTable final{};
             {
                 std::lock_guard lk{m_sync};
                 m_is_down = true;
                 final = std::move(m_promises);
             }
-            for (auto&&[k, v]: final) v->fail(std::make_exception_ptr(ChannelClosed()));
+            for (auto&&[k, v]: final) v->fail(error);
         }
 
         void process_incoming_message(StagingTable &staging, Block block, int32_t id) {
-            auto stage_it = staging.find(id);
-            if (stage_it == staging.end()) stage_it = staging.insert_or_assign(id, Message{}).first;
-            stage_it->second.blocks[stage_it->second.stage++] = std::move(block);
-            if (stage_it->second.stage == 3) {
-                release_received_message(id, std::move(stage_it->second));
-                staging.erase(stage_it);
-            }
+            Message message{};
+            if (!stage_block(staging, std::move(block), id, message, m_endpoint->limits())) return;
+            if (id & OneWayFlag)
+                release_pushed_message(std::move(message));
+            else
+                release_received_message(id, std::move(message));
         };
 
+        void release_pushed_message(Message &&message) {
+            if (!m_options.on_push) return;
+            auto memory = kls::pmr::default_resource();
+            // a failing push is reported and dropped, it must not take the whole connection down
+            try { m_options.on_push(unpack_request(std::move(message), m_endpoint->limits(), memory)); }
+            catch (std::exception &e) { puts(e.what()); }
+            catch (...) {}
+        }
+
         void release_received_message(int32_t id, Message &&message) {
             std::lock_guard lk{m_sync};
             auto promise_it = m_promises.find(id);
@@ -170,40 +502,36 @@ namespace {
             m_promises.erase(promise_it);
         }
 
-        ValueAsync<> send_message(int32_t id, Message message) {
-            try {
-                co_await locked_send_message(*m_endpoint, std::move(message), m_mutex);
-            }
-            catch (...) {
-                std::lock_guard lk{m_sync};
-                m_promises.erase(id);
-                throw;
-            }
-        }
-
         ValueAsync<> close_impl() {
-            co_await post_shutdown_user(*m_endpoint, m_mutex);
+            co_await m_sender.post(ShutdownId);
             co_await std::move(m_receive);
         }
     };
 
     class ServerImpl: public ServerEndpoint {
     public:
-        explicit ServerImpl(std::unique_ptr<Endpoint> endpoint) : m_endpoint(std::move(endpoint)) {}
+        ServerImpl(std::unique_ptr<Endpoint> endpoint, ServerOptions options) :
+                m_endpoint(std::move(endpoint)), m_sender(*m_endpoint), m_options(std::move(options)) {}
 
         ValueAsync<> run() override {
             co_await uses(*m_endpoint, [this](Endpoint& ep) -> ValueAsync<> {
                 StagingTable staging{};
-                for (;;) {
-                    auto block = co_await ep.get();
-                    const auto id = block.id();
-                    if (id < 0) {
-                        co_await handle_shutdown_user(ep, id, m_mutex);
-                        co_await join_all_standing_requests();
-                        break;
+                std::exception_ptr error{};
+                try {
+                    for (;;) {
+                        auto block = co_await ep.get();
+                        auto id = block.id();
+                        if (id < 0) {
+                            if (id == ShutdownId) co_await m_sender.post(ShutdownAckId);
+                            break;
+                        }
+                        process_incoming_message(staging, std::move(block), id);
                     }
-                    process_incoming_message(staging, std::move(block), id);
                 }
+                catch (...) { error = std::current_exception(); }
+                // running handlers still use the sender, so they finish before the endpoint is closed
+                co_await join_all_standing_requests();
+                if (error) std::rethrow_exception(error);
             });
         }
 
@@ -217,44 +545,93 @@ namespace {
             for (auto&&[k, v]: final) co_await std::move(v);
         }
 
+        ValueAsync<> push(Request message) override {
+            {
+                std::lock_guard lk{m_lock};
+                if (m_is_down) throw ChannelClosed();
+            }
+            const auto id = get_one_way_id(m_top_one_way_id);
+            co_await m_sender.send(std::move(message), id);
+        }
+
         ValueAsync<> close() override {
             {
                 std::lock_guard lk{m_lock};
                 if (m_is_down) co_return;
             }
-            co_await post_shutdown_user(*m_endpoint, m_mutex);
+            co_await m_sender.post(ShutdownId);
         }
     private:
-        Mutex m_mutex{};
         std::unique_ptr<Endpoint> m_endpoint;
+        Sender m_sender;
         // async handling
-        using StagingTable = std::unordered_map<int32_t, Message>;
-        using PromiseTable = std::unordered_map<int32_t, ValueAsync<>>;
+        using PromiseTable = kls::phttp::detail::RecyclingMap<int32_t, ValueAsync<>>;
         SpinLock m_lock{};
         bool m_is_down{false};
         PromiseTable m_processing{};
+        std::atomic<int32_t> m_top_one_way_id{0};
+        // execution policy
+        ServerOptions m_options;
+        // average run time of the handler per resource, for the adaptive policy
+        kls::phttp::detail::BoundedTable<std::atomic<int64_t>> m_stats{1024};
 
         void process_incoming_message(StagingTable &staging, Block block, int32_t id) {
-            auto stage_it = staging.find(id);
-            if (stage_it == staging.end()) stage_it = staging.insert_or_assign(id, Message{}).first;
-            stage_it->second.blocks[stage_it->second.stage++] = std::move(block);
-            if (stage_it->second.stage == 3) {
-                start_request_handle(id, std::move(stage_it->second));
-                staging.erase(stage_it);
-            }
+            Message message{};
+            if (stage_block(staging, std::move(block), id, message, m_endpoint->limits()))
+                start_request_handle(id, std::move(message));
         }
 
+        // an inline handler may complete and erase its entry before it returns here, so the slot is reserved first
         void start_request_handle(int32_t id, Message&& msg) {
+            {
+                std::lock_guard lk{m_lock};
+                m_processing.insert({id, ValueAsync<>{}});
+            }
+            auto handle = handle_request_async(id, std::move(msg));
             std::lock_guard lk{m_lock};
-            m_processing.insert({id, handle_request_async(id, std::move(msg))});
+            if (auto it = m_processing.find(id); it != m_processing.end()) it->second = std::move(handle);
+        }
+
+        [[nodiscard]] Execution execution_for(std::string_view resource) const {
+            const auto route = m_options.routes.find(resource);
+            return route != m_options.routes.end() ? route->second : m_options.execution;
+        }
+
+        static void record(std::atomic<int64_t> *average, std::chrono::steady_clock::time_point start) noexcept {
+            if (!average) return;
+            const auto sample = (std::chrono::steady_clock::now() - start).count();
+            const auto last = average->load(std::memory_order_relaxed);
+            average->store(last + (sample - last) / 8, std::memory_order_relaxed);
         }
 
         ValueAsync<> handle_request_async(int32_t id, Message msg) {
-            co_await Redispatch{};
+            // the request line decides the execution policy, unless every request is redispatched anyway
+            const auto always_redispatch = m_options.execution == Execution::Redispatch && m_options.routes.empty();
+            if (always_redispatch) co_await Redispatch{};
             auto memory = kls::pmr::default_resource();
             try {
-                auto response = pack(co_await m_trivial(unpack_request(std::move(msg), memory), m_data), id, memory);
-                co_await locked_send_message(*m_endpoint, std::move(response), m_mutex);
+                auto request = unpack_request(std::move(msg), m_endpoint->limits(), memory);
+                std::atomic<int64_t> *average{nullptr};
+                if (!always_redispatch) {
+                    const auto execution = execution_for(request.line.resource());
+                    if (execution == Execution::Adaptive) average = &m_stats.get(request.line.resource());
+                    const auto over_budget = average &&
+                            average->load(std::memory_order_relaxed) > m_options.inline_budget.count();
+                    if (execution == Execution::Redispatch || over_budget) co_await Redispatch{};
+                }
+                const auto start = std::chrono::steady_clock::now();
+                if (id & OneWayFlag) {
+                    if (m_notified_trivial)
+                        co_await m_notified_trivial(std::move(request), m_notified_data);
+                    else
+                        (void) co_await m_trivial(std::move(request), m_data);
+                    record(average, start);
+                }
+                else {
+                    auto response = co_await m_trivial(std::move(request), m_data);
+                    record(average, start);
+                    co_await m_sender.send(std::move(response), id);
+                }
             }
             catch (std::exception &e) { puts(e.what()); }
             catch (...) {}
@@ -269,11 +646,11 @@ namespace kls::phttp {
         return "Channel Closed By Client/Server Request";
     }
 
-    std::unique_ptr<ClientEndpoint> ClientEndpoint::create(std::unique_ptr<Endpoint> ep) {
-        return std::make_unique<ClientImpl>(std::move(ep));
+    std::unique_ptr<ClientEndpoint> ClientEndpoint::create(std::unique_ptr<Endpoint> ep, ClientOptions options) {
+        return std::make_unique<ClientImpl>(std::move(ep), std::move(options));
     }
 
-    std::unique_ptr<ServerEndpoint> ServerEndpoint::create(std::unique_ptr<Endpoint> ep) {
-        return std::make_unique<ServerImpl>(std::move(ep));
+    std::unique_ptr<ServerEndpoint> ServerEndpoint::create(std::unique_ptr<Endpoint> ep, ServerOptions options) {
+        return std::make_unique<ServerImpl>(std::move(ep), std::move(options));
     }
 }
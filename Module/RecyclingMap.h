@@ -0,0 +1,75 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+#include <unordered_map>
+
+namespace kls::phttp::detail {
+    // an unordered_map that keeps the nodes of erased entries for later inserts, so that a table with a steady
+    // number of entries coming and going stops allocating. values of kept nodes are reset if they can be
+    template<class K, class V>
+    class RecyclingMap {
+        using Map = std::unordered_map<K, V>;
+        static constexpr size_t spare_limit = 256;
+    public:
+        using iterator = typename Map::iterator;
+
+        [[nodiscard]] iterator begin() noexcept { return m_map.begin(); }
+        [[nodiscard]] iterator end() noexcept { return m_map.end(); }
+        [[nodiscard]] iterator find(const K &key) { return m_map.find(key); }
+        [[nodiscard]] size_t size() const noexcept { return m_map.size(); }
+
+        std::pair<iterator, bool> insert(std::pair<K, V> entry) {
+            if (m_spare.empty()) return m_map.insert(std::move(entry));
+            auto node = std::move(m_spare.back());
+            m_spare.pop_back();
+            node.key() = std::move(entry.first);
+            node.mapped() = std::move(entry.second);
+            auto result = m_map.insert(std::move(node));
+            if (!result.inserted) keep(std::move(result.node));
+            return {result.position, result.inserted};
+        }
+
+        void erase(iterator it) { keep(m_map.extract(it)); }
+
+        size_t erase(const K &key) {
+            const auto it = m_map.find(key);
+            if (it == m_map.end()) return 0;
+            erase(it);
+            return 1;
+        }
+    private:
+        Map m_map{};
+        std::vector<typename Map::node_type> m_spare{};
+
+        void keep(typename Map::node_type node) {
+            if (m_spare.size() >= spare_limit) return;
+            if constexpr (std::is_default_constructible_v<V>) node.mapped() = V{};
+            m_spare.push_back(std::move(node));
+        }
+    };
+}
@@ -0,0 +1,89 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <queue>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace kls::phttp::detail {
+    // runs callbacks at their deadlines on a thread of its own, callbacks must return quickly
+    class Timer {
+        using Clock = std::chrono::steady_clock;
+    public:
+        Timer() : m_thread([this]() { run(); }) {}
+
+        ~Timer() {
+            {
+                std::lock_guard lk{m_lock};
+                m_stop = true;
+            }
+            m_wake.notify_one();
+            m_thread.join();
+        }
+
+        void schedule(Clock::time_point at, std::function<void()> callback) {
+            {
+                std::lock_guard lk{m_lock};
+                m_queue.push(Entry{at, std::move(callback)});
+            }
+            m_wake.notify_one();
+        }
+    private:
+        struct Entry {
+            Clock::time_point at;
+            std::function<void()> callback;
+
+            bool operator>(const Entry &other) const noexcept { return at > other.at; }
+        };
+
+        std::mutex m_lock{};
+        std::condition_variable m_wake{};
+        bool m_stop{false};
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<>> m_queue{};
+        std::thread m_thread;
+
+        void run() {
+            std::unique_lock lk{m_lock};
+            while (!m_stop) {
+                if (m_queue.empty()) {
+                    m_wake.wait(lk);
+                    continue;
+                }
+                if (const auto at = m_queue.top().at; at > Clock::now()) {
+                    m_wake.wait_until(lk, at);
+                    continue;
+                }
+                auto callback = m_queue.top().callback;
+                m_queue.pop();
+                lk.unlock();
+                callback();
+                lk.lock();
+            }
+        }
+    };
+}
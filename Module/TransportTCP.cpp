@@ -21,7 +21,18 @@
 */
 
 #include <utility>
+#include <iterator>
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
 #include "kls/io/TCPUtil.h"
+#include "kls/phttp/Error.h"
 #include "kls/phttp/Transport.h"
 #include "kls/essential/Unsafe.h"
 
@@ -32,24 +43,157 @@ using namespace kls::essential;
 using namespace kls::coroutine;
 
 namespace {
+#if defined(_WIN32)
+    using NativeSocket = SOCKET;
+    using OptionLength = int;
+#else
+    using NativeSocket = int;
+    using OptionLength = socklen_t;
+#endif
+
+    // options are applied on a best-effort basis, the effective values can be read back with query_options
+    void set_option(NativeSocket socket, int level, int name, int value) noexcept {
+        setsockopt(socket, level, name, reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    int32_t get_option(NativeSocket socket, int level, int name) noexcept {
+        int value{};
+        OptionLength length = sizeof(value);
+        if (getsockopt(socket, level, name, reinterpret_cast<char *>(&value), &length)) return 0;
+        return int32_t(value);
+    }
+
+    void apply_options(NativeSocket socket, const SocketOptions &options) noexcept {
+        set_option(socket, IPPROTO_TCP, TCP_NODELAY, options.no_delay);
+        if (options.send_buffer) set_option(socket, SOL_SOCKET, SO_SNDBUF, options.send_buffer);
+        if (options.receive_buffer) set_option(socket, SOL_SOCKET, SO_RCVBUF, options.receive_buffer);
+        set_option(socket, SOL_SOCKET, SO_KEEPALIVE, options.keep_alive);
+#if defined(TCP_QUICKACK)
+        if (options.quick_ack) set_option(socket, IPPROTO_TCP, TCP_QUICKACK, 1);
+#endif
+#if defined(SO_BUSY_POLL)
+        if (options.busy_poll) set_option(socket, SOL_SOCKET, SO_BUSY_POLL, options.busy_poll);
+#endif
+#if defined(TCP_USER_TIMEOUT)
+        if (options.user_timeout) set_option(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, options.user_timeout);
+#endif
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        if (options.keep_alive_idle) set_option(socket, IPPROTO_TCP, TCP_KEEPIDLE, options.keep_alive_idle);
+        if (options.keep_alive_interval)
+            set_option(socket, IPPROTO_TCP, TCP_KEEPINTVL, options.keep_alive_interval);
+        if (options.keep_alive_count) set_option(socket, IPPROTO_TCP, TCP_KEEPCNT, options.keep_alive_count);
+#endif
+    }
+
+    SocketOptions query_options(NativeSocket socket) noexcept {
+        SocketOptions options{};
+        options.no_delay = get_option(socket, IPPROTO_TCP, TCP_NODELAY) != 0;
+        options.send_buffer = get_option(socket, SOL_SOCKET, SO_SNDBUF);
+        options.receive_buffer = get_option(socket, SOL_SOCKET, SO_RCVBUF);
+        options.keep_alive = get_option(socket, SOL_SOCKET, SO_KEEPALIVE) != 0;
+#if defined(TCP_QUICKACK)
+        options.quick_ack = get_option(socket, IPPROTO_TCP, TCP_QUICKACK) != 0;
+#endif
+#if defined(SO_BUSY_POLL)
+        options.busy_poll = get_option(socket, SOL_SOCKET, SO_BUSY_POLL);
+#endif
+#if defined(TCP_USER_TIMEOUT)
+        options.user_timeout = get_option(socket, IPPROTO_TCP, TCP_USER_TIMEOUT);
+#endif
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        options.keep_alive_idle = get_option(socket, IPPROTO_TCP, TCP_KEEPIDLE);
+        options.keep_alive_interval = get_option(socket, IPPROTO_TCP, TCP_KEEPINTVL);
+        options.keep_alive_count = get_option(socket, IPPROTO_TCP, TCP_KEEPCNT);
+#endif
+        return options;
+    }
+
+#if !defined(_WIN32)
+    // offers the chunks to the kernel in one call without waiting for room, returns the number of bytes it took
+    template<class Chunks>
+    size_t send_vectored(NativeSocket socket, const Chunks &chunks) noexcept {
+        iovec vectors[64];
+        size_t count = 0;
+        for (auto &&chunk: chunks) {
+            if (count == std::size(vectors)) break;
+            vectors[count++] = iovec{.iov_base = chunk.begin(), .iov_len = size_t(chunk.end() - chunk.begin())};
+        }
+        msghdr message{};
+        message.msg_iov = vectors;
+        message.msg_iovlen = count;
+#if defined(MSG_NOSIGNAL)
+        const auto sent = sendmsg(socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+        const auto sent = sendmsg(socket, &message, MSG_DONTWAIT);
+#endif
+        return sent > 0 ? size_t(sent) : 0;
+    }
+#endif
+
+    // every socket option goes through the native handle, a kls.io without it must not silently drop them
+    static_assert(requires(const SocketTCP &socket) { socket.native_handle(); },
+                  "phttp socket options need kls::io::SocketTCP::native_handle()");
+
     class EndpointImpl : public Endpoint {
     public:
-        EndpointImpl(kls::SafeHandle<SocketTCP> s, Peer p) noexcept: m_peer(std::move(p)), m_socket(std::move(s)) {}
+        EndpointImpl(kls::SafeHandle<SocketTCP> s, Peer p, const TransportOptions &options) noexcept:
+                m_peer(std::move(p)), m_socket(std::move(s)), m_limits(options.limits),
+                m_quick_ack(options.socket.quick_ack) {
+            apply_options(native(), options.socket);
+        }
 
         [[nodiscard]] Peer peer() const noexcept override { return m_peer; }
 
+        [[nodiscard]] const Limits &limits() const noexcept override { return m_limits; }
+
+        [[nodiscard]] std::optional<SocketOptions> socket_options() const override { return query_options(native()); }
+
         ValueAsync<> put(Block block) override {
             (co_await write_fully(*m_socket, block.bytes())).get_result();
         }
 
+        ValueAsync<> put_slice(int32_t id, kls::Span<> content) override {
+            char buffer[8];
+            const auto size = int32_t(content.end() - content.begin());
+            SpanWriter<std::endian::little> headWriter{{buffer, 8}};
+            headWriter.put<int32_t>(id);
+            headWriter.put<int32_t>(size);
+            (co_await write_fully(*m_socket, {buffer, 8})).get_result();
+            (co_await write_fully(*m_socket, content)).get_result();
+        }
+
+        // the whole buffer is offered in one vectored write, whatever the socket could not take at once follows
+        // through kls.io, which also reports any error of the connection
+        ValueAsync<> put_buffer(const OutputBuffer &buffer) override {
+            const auto chunks = buffer.chunks();
+#if !defined(_WIN32)
+            auto skip = send_vectored(native(), chunks);
+#else
+            size_t skip = 0;
+#endif
+            for (auto &&chunk: chunks) {
+                const auto size = size_t(chunk.end() - chunk.begin());
+                if (skip >= size) {
+                    skip -= size;
+                    continue;
+                }
+                (co_await write_fully(*m_socket, {chunk.begin() + skip, ptrdiff_t(size - skip)})).get_result();
+                skip = 0;
+            }
+        }
+
         ValueAsync<Block> get() override {
             char buffer[8];
             (co_await read_fully(*m_socket, {buffer, 8})).get_result();
             SpanReader<std::endian::little> headReader{{buffer, 8}};
             const auto msgId = headReader.get<int32_t>();
             const auto msgLen = headReader.get<int32_t>();
+            if (msgLen < 0 || msgLen > m_limits.max_block_size) throw MalformedBlock();
             auto block = Block(msgLen, msgId, kls::pmr::default_resource());
             (co_await read_fully(*m_socket, block.content())).get_result();
+#if defined(TCP_QUICKACK)
+            if (m_quick_ack) set_option(native(), IPPROTO_TCP, TCP_QUICKACK, 1);
+#endif
             co_return block;
         }
 
@@ -57,29 +201,37 @@ namespace {
     private:
         Peer m_peer;
         kls::SafeHandle<SocketTCP> m_socket;
+        Limits m_limits;
+        bool m_quick_ack;
+
+        [[nodiscard]] NativeSocket native() const noexcept { return NativeSocket(m_socket->native_handle()); }
     };
 
     class ServerImpl : public Host {
     public:
-        explicit ServerImpl(std::unique_ptr<AcceptorTCP> a) noexcept: m_accept(std::move(a)) {}
+        ServerImpl(std::unique_ptr<AcceptorTCP> a, TransportOptions options) noexcept:
+                m_accept(std::move(a)), m_options(std::move(options)) {}
 
         ValueAsync<std::unique_ptr<Endpoint>> accept() override {
             auto&&[peer, stream] = co_await m_accept->once();
-            co_return std::make_unique<EndpointImpl>(std::move(stream), peer);
+            co_return std::make_unique<EndpointImpl>(std::move(stream), peer, m_options);
         }
 
         ValueAsync<> close() override { co_await m_accept->close(); }
     private:
         std::unique_ptr<AcceptorTCP> m_accept;
+        TransportOptions m_options;
     };
 }
 
 namespace kls::phttp {
-    [[nodiscard]] std::unique_ptr<Host> listen_tcp(io::Peer local, int backlog) {
-        return std::make_unique<ServerImpl>(acceptor_tcp(local.first, local.second, backlog));
+    [[nodiscard]] std::unique_ptr<Host> listen_tcp(io::Peer local, int backlog, TransportOptions options) {
+        return std::make_unique<ServerImpl>(acceptor_tcp(local.first, local.second, backlog), std::move(options));
     }
 
-    [[nodiscard]] coroutine::ValueAsync<std::unique_ptr<Endpoint>> connect_tcp(io::Peer peer) {
-        co_return std::make_unique<EndpointImpl>(co_await connect(peer.first, peer.second), peer);
+    [[nodiscard]] coroutine::ValueAsync<std::unique_ptr<Endpoint>> connect_tcp(
+            io::Peer peer, TransportOptions options
+    ) {
+        co_return std::make_unique<EndpointImpl>(co_await connect(peer.first, peer.second), peer, options);
     }
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <span>
+#include <chrono>
+#include <string>
+#include "Transport.h"
+
+namespace kls::phttp {
+    enum class Direction : int32_t { Inbound = 0, Outbound = 1 };
+
+    /// <summary>
+    /// Wraps an endpoint so that every block it carries is appended to a capture file at path, together with the
+    /// time it was seen relative to the start of the capture and its direction. Blocks are recorded as they are put
+    /// and as they are returned from get. Throws std::system_error if the file cannot be created.
+    /// </summary>
+    [[nodiscard]] std::unique_ptr<Endpoint> capture(std::unique_ptr<Endpoint> endpoint, const std::string &path);
+
+    struct CaptureRecord {
+        std::chrono::nanoseconds time;
+        Direction direction;
+        int32_t id;
+        /// Points into the mapped file and stays valid as long as the CaptureFile
+        Span<> content;
+    };
+
+    /// <summary>
+    /// A capture file mapped into memory. Records are indexed when the file is opened and read in place.
+    /// </summary>
+    struct CaptureFile : PmrBase {
+        [[nodiscard]] virtual std::span<const CaptureRecord> records() const noexcept = 0;
+    };
+
+    /// Throws std::system_error if the file cannot be mapped and MalformedBlock if it is not a complete capture
+    [[nodiscard]] std::unique_ptr<CaptureFile> open_capture(const std::string &path);
+
+    enum class ReplaySpeed {
+        /// Blocks are released with the same spacing as they were captured. The waits run on a timer thread owned by
+        /// the replay, so pacing does not hold an executor thread
+        Original,
+        /// Blocks are released as fast as they are consumed
+        Maximum
+    };
+
+    /// <summary>
+    /// An endpoint that returns the captured data blocks of one direction from get, followed by a shutdown block.
+    /// Everything put on it is discarded. Pass the inbound direction of a server side capture, or the outbound
+    /// direction of a client side capture, to ServerEndpoint::create to rerun the traffic against a handler.
+    /// The capture must outlive the endpoint.
+    /// </summary>
+    [[nodiscard]] std::unique_ptr<Endpoint> replay_endpoint(
+            const CaptureFile &capture, Direction direction, ReplaySpeed speed
+    );
+
+    struct ReplayResult {
+        int64_t sent;
+        int64_t received;
+        std::chrono::nanoseconds elapsed;
+    };
+
+    /// <summary>
+    /// Sends the captured data blocks of one direction to target as client traffic, then shuts the connection down
+    /// and collects what the peer sends until it acknowledges. Wrap target with capture to record per block timing
+    /// of the replay for comparison with the original.
+    /// </summary>
+    [[nodiscard]] coroutine::ValueAsync<ReplayResult> replay(
+            const CaptureFile &capture, Direction direction, Endpoint &target, ReplaySpeed speed
+    );
+}
@@ -0,0 +1,234 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <bit>
+#include <tuple>
+#include <string>
+#include <cstring>
+#include <utility>
+#include <type_traits>
+#include "Error.h"
+#include "Transport.h"
+
+namespace kls::phttp {
+    /// <summary>
+    /// Specialize with `static constexpr auto fields = std::tuple{&T::a, &T::b, ...};` to make T usable with Codec.
+    /// Fields are laid out in the listed order without padding. Arithmetic and enum fields are stored little-endian
+    /// with their own size, strings are stored as phttp_string.
+    /// </summary>
+    template<class T>
+    struct CodecFields;
+
+    namespace detail::codec {
+        template<class M>
+        struct member;
+
+        template<class C, class M>
+        struct member<M C::*> { using type = M; };
+
+        template<size_t N>
+        struct raw;
+        template<> struct raw<1> { using type = uint8_t; };
+        template<> struct raw<2> { using type = uint16_t; };
+        template<> struct raw<4> { using type = uint32_t; };
+        template<> struct raw<8> { using type = uint64_t; };
+
+        template<class U>
+        concept Scalar = std::is_arithmetic_v<U> || std::is_enum_v<U>;
+
+        template<class U>
+        struct is_string : std::false_type {};
+
+        template<class Traits, class Alloc>
+        struct is_string<std::basic_string<char, Traits, Alloc>> : std::true_type {};
+
+        template<class U>
+        concept String = is_string<U>::value;
+
+        template<Scalar U>
+        void store(char *out, U value) noexcept {
+            auto bits = std::bit_cast<typename raw<sizeof(U)>::type>(value);
+            if constexpr (std::endian::native == std::endian::little)
+                std::memcpy(out, &bits, sizeof(U));
+            else
+                for (size_t i = 0; i < sizeof(U); ++i) out[i] = char(uint8_t(bits >> (i * 8)));
+        }
+
+        template<Scalar U>
+        [[nodiscard]] U load(const char *in) noexcept {
+            typename raw<sizeof(U)>::type bits{};
+            if constexpr (std::endian::native == std::endian::little)
+                std::memcpy(&bits, in, sizeof(U));
+            else
+                for (size_t i = 0; i < sizeof(U); ++i) bits |= decltype(bits)(uint8_t(in[i])) << (i * 8);
+            return std::bit_cast<U>(bits);
+        }
+
+        // size of the part of a field that does not depend on its value
+        template<class U>
+        [[nodiscard]] constexpr int32_t fixed_size() noexcept {
+            if constexpr (Scalar<U>) return int32_t(sizeof(U)); else return 4;
+        }
+
+        template<auto Member, class P>
+        [[nodiscard]] constexpr bool same_member(P candidate) noexcept {
+            if constexpr (std::is_same_v<decltype(Member), P>) return Member == candidate; else return false;
+        }
+    }
+
+    /// <summary>
+    /// Encoder and decoder for a type described by CodecFields. The encoded size is computed before encoding,
+    /// so encoding performs exactly one allocation and writes straight into the resulting block.
+    /// </summary>
+    template<class T>
+    class Codec {
+        static constexpr size_t count = std::tuple_size_v<std::remove_cvref_t<decltype(CodecFields<T>::fields)>>;
+
+        template<size_t I>
+        using field_t = typename detail::codec::member<
+                std::remove_cvref_t<decltype(std::get<I>(CodecFields<T>::fields))>
+        >::type;
+
+        template<size_t I>
+        [[nodiscard]] static constexpr int32_t offset() noexcept {
+            return []<size_t... J>(std::index_sequence<J...>) {
+                return (int32_t(0) + ... + detail::codec::fixed_size<field_t<J>>());
+            }(std::make_index_sequence<I>{});
+        }
+
+        template<auto Member>
+        [[nodiscard]] static constexpr size_t index_of() noexcept {
+            return []<size_t... I>(std::index_sequence<I...>) {
+                size_t result = count;
+                ((result = (result == count && detail::codec::same_member<Member>(
+                        std::get<I>(CodecFields<T>::fields)
+                )) ? I : result), ...);
+                return result;
+            }(std::make_index_sequence<count>{});
+        }
+
+        template<class U>
+        static char *put(char *out, const U &value) noexcept {
+            if constexpr (detail::codec::Scalar<U>) {
+                detail::codec::store(out, value);
+                return out + sizeof(U);
+            }
+            else {
+                static_assert(detail::codec::String<U>, "Unsupported field type for Codec");
+                detail::codec::store(out, int32_t(value.size()));
+                std::memcpy(out + 4, value.data(), value.size());
+                return out + 4 + value.size();
+            }
+        }
+
+        template<class U>
+        static const char *get(const char *in, const char *end, U &value) {
+            if constexpr (detail::codec::Scalar<U>) {
+                if (end - in < ptrdiff_t(sizeof(U))) throw MalformedBlock();
+                value = detail::codec::load<U>(in);
+                return in + sizeof(U);
+            }
+            else {
+                static_assert(detail::codec::String<U>, "Unsupported field type for Codec");
+                if (end - in < 4) throw MalformedBlock();
+                const auto length = detail::codec::load<int32_t>(in);
+                if (length < 0 || end - in - 4 < length) throw MalformedBlock();
+                value.assign(in + 4, size_t(length));
+                return in + 4 + length;
+            }
+        }
+
+        // number of fields before the first variable-sized one
+        static constexpr size_t fixed_prefix_count = []<size_t... I>(std::index_sequence<I...>) {
+            size_t result = 0;
+            ((result += (result == I && detail::codec::Scalar<field_t<I>>)), ...);
+            return result;
+        }(std::make_index_sequence<count>{});
+    public:
+        /// True if every field has a fixed size, in which case every encoded value is exactly fixed_size bytes
+        static constexpr bool is_fixed = fixed_prefix_count == count;
+        static constexpr int32_t fixed_size = offset<count>();
+
+        [[nodiscard]] static int32_t size(const T &value) noexcept {
+            if constexpr (is_fixed) return fixed_size;
+            else return []<size_t... I>(const T &value, std::index_sequence<I...>) {
+                const auto variable = [](const auto &field) noexcept -> int32_t {
+                    if constexpr (detail::codec::String<std::remove_cvref_t<decltype(field)>>)
+                        return int32_t(field.size());
+                    else return 0;
+                };
+                return (fixed_size + ... + variable(value.*std::get<I>(CodecFields<T>::fields)));
+            }(value, std::make_index_sequence<count>{});
+        }
+
+        /// Writes the encoded value to out, which must hold at least size(value) bytes. Returns the end of the output.
+        static char *encode_into(const T &value, char *out) noexcept {
+            return []<size_t... I>(const T &value, char *out, std::index_sequence<I...>) {
+                ((out = put(out, value.*std::get<I>(CodecFields<T>::fields))), ...);
+                return out;
+            }(value, out, std::make_index_sequence<count>{});
+        }
+
+        [[nodiscard]] static Block encode(const T &value, pmr::MemoryResource *memory = pmr::default_resource()) {
+            auto block = Block(size(value), memory);
+            encode_into(value, block.content().begin());
+            return block;
+        }
+
+        /// Decodes a value, throwing MalformedBlock if the content does not hold exactly one encoded value
+        [[nodiscard]] static T decode(const Block &block) {
+            T value{};
+            const auto content = block.content();
+            const auto end = []<size_t... I>(T &value, const char *in, const char *end, std::index_sequence<I...>) {
+                ((in = get(in, end, value.*std::get<I>(CodecFields<T>::fields))), ...);
+                return in;
+            }(value, content.begin(), content.end(), std::make_index_sequence<count>{});
+            if (end != content.end()) throw MalformedBlock();
+            return value;
+        }
+
+        /// <summary>
+        /// Reads fixed-size fields in place from encoded content without decoding the whole value.
+        /// Only fields that are preceded by fixed-size fields alone can be read through a view.
+        /// </summary>
+        class View {
+        public:
+            /// Throws MalformedBlock if the content is too short to hold the fixed-size fields
+            explicit View(Span<> content) : m_data(content.begin()) {
+                if (content.end() - content.begin() < offset<fixed_prefix_count>()) throw MalformedBlock();
+            }
+            explicit View(const Block &block) : View(block.content()) {}
+
+            template<auto Member>
+            [[nodiscard]] auto get() const noexcept {
+                constexpr auto index = index_of<Member>();
+                static_assert(index < count, "Member is not listed in CodecFields");
+                static_assert(index < fixed_prefix_count, "Member does not have a fixed offset");
+                return detail::codec::load<field_t<index>>(m_data + offset<index>());
+            }
+        private:
+            const char *m_data;
+        };
+    };
+}
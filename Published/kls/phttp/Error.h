@@ -32,4 +32,12 @@ namespace kls::phttp {
     struct InconsistentState: std::exception {
         [[nodiscard]] const char *what() const noexcept override;
     };
+
+    /// <summary>
+    /// This error is emitted when a block received from the peer is malformed or exceeds the configured limits
+    /// The connection that carried the block can no longer be trusted and should be closed
+    /// </summary>
+    struct MalformedBlock: std::exception {
+        [[nodiscard]] const char *what() const noexcept override;
+    };
 }
\ No newline at end of file
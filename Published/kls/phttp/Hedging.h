@@ -0,0 +1,74 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Protocol.h"
+
+namespace kls::phttp {
+    struct HedgingOptions {
+        /// Requests with one of these verbs are idempotent and may be hedged
+        std::vector<std::string> idempotent_verbs{"GET", "HEAD"};
+        /// Requests carrying this header with a non-empty value are idempotent as well
+        std::string idempotent_header{"Idempotent"};
+        /// <summary>
+        /// The duplicate of a request is sent once the request has been outstanding for this percentile of the
+        /// recent latencies of its verb and resource, and never earlier than min_delay. Until min_samples latencies
+        /// have been seen, initial_delay is used.
+        /// </summary>
+        double percentile{95.0};
+        std::chrono::nanoseconds min_delay{std::chrono::microseconds(100)};
+        std::chrono::nanoseconds initial_delay{std::chrono::milliseconds(10)};
+        int32_t min_samples{16};
+        /// Number of recent latencies kept for every verb and resource
+        int32_t window{128};
+        /// Largest share of requests that are hedged, further duplicates are skipped until the share drops
+        double max_hedge_ratio{0.1};
+    };
+
+    struct HedgingStats {
+        /// Requests executed through the client
+        int64_t requests;
+        /// Requests for which a duplicate was sent to a second peer
+        int64_t hedged;
+        /// Hedged requests answered first by the duplicate
+        int64_t hedge_wins;
+    };
+
+    /// <summary>
+    /// A client over several peers serving the same resources. Requests are spread over the peers in turn.
+    /// An idempotent request that is still outstanding after the hedging delay is sent again to the next peer
+    /// and the first response is taken. The other response is discarded when it arrives, as requests can not be
+    /// withdrawn once sent. A request fails only when every copy of it failed.
+    /// </summary>
+    class HedgingClient : public ClientEndpoint {
+    public:
+        [[nodiscard]] virtual HedgingStats stats() const noexcept = 0;
+        /// peers must not be empty, with a single peer nothing is hedged
+        static std::unique_ptr<HedgingClient> create(
+                std::vector<std::unique_ptr<ClientEndpoint>> peers, HedgingOptions options = {}
+        );
+    };
+}
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <vector>
 #include <string_view>
 #include <memory_resource>
 #include "kls/STL.h"
@@ -31,6 +32,13 @@
 namespace kls::phttp {
     namespace detail {
         using alias = kls::AllocAliased<pmr::PolymorphicAllocator>;
+
+        /// Transparent string hash, for tables looked up by std::string_view
+        struct StringHash {
+            using hash_type = std::hash<std::string_view>;
+            using is_transparent = void;
+            [[nodiscard]] size_t operator()(std::string_view str) const noexcept { return hash_type{}(str); }
+        };
     }
 
     class RequestLine {
@@ -50,8 +58,14 @@ namespace kls::phttp {
         [[nodiscard]] std::string_view verb() const noexcept { return {m_verb}; }
         [[nodiscard]] std::string_view version() const noexcept { return {m_version}; }
         [[nodiscard]] std::string_view resource() const noexcept { return {m_resource}; }
+        /// Size of the encoded content, as written by pack_into
+        [[nodiscard]] int32_t packed_size() const noexcept;
+        /// Encodes the content into writer, which must have packed_size() bytes left
+        void pack_into(essential::SpanWriter<std::endian::little> &writer) const noexcept;
         [[nodiscard]] Block pack(int32_t id, pmr::MemoryResource *memory) const;
         [[nodiscard]] static RequestLine unpack(const Block& block, pmr::MemoryResource *memory);
+        /// A copy of all three fields, the version included
+        [[nodiscard]] RequestLine clone(pmr::MemoryResource *memory) const;
     private:
         RequestLine(alias::string &&verb, alias::string &&version, alias::string &&resource)
                 : m_verb{std::move(verb)}, m_version{std::move(version)}, m_resource{std::move(resource)} {}
@@ -75,6 +89,10 @@ namespace kls::phttp {
 
         [[nodiscard]] int32_t code() const noexcept { return m_code; }
         [[nodiscard]] std::string_view message() const noexcept { return {m_message}; }
+        /// Size of the encoded content, as written by pack_into
+        [[nodiscard]] int32_t packed_size() const noexcept;
+        /// Encodes the content into writer, which must have packed_size() bytes left
+        void pack_into(essential::SpanWriter<std::endian::little> &writer) const noexcept;
         [[nodiscard]] Block pack(int32_t id, pmr::MemoryResource *memory) const;
         [[nodiscard]] static ResponseLine unpack(const Block& block, pmr::MemoryResource *memory);
     private:
@@ -83,14 +101,6 @@ namespace kls::phttp {
     };
 
     class Headers {
-        struct string_hash {
-            using hash_type = std::hash<std::string_view>;
-            using is_transparent = void;
-            [[nodiscard]] size_t operator()(const char *str) const { return hash_type{}(str); }
-            [[nodiscard]] size_t operator()(std::string_view str) const { return hash_type{}(str); }
-            [[nodiscard]] size_t operator()(std::string const &str) const { return hash_type{}(str); }
-        };
-
         using alias = detail::alias;
     public:
         explicit Headers(
@@ -109,21 +119,39 @@ namespace kls::phttp {
         }
 
         void set(std::string_view key, std::string_view value);
+        [[nodiscard]] Headers clone(pmr::MemoryResource *memory) const;
+        /// Size of the encoded content, as written by pack_into
+        [[nodiscard]] int32_t packed_size() const noexcept;
+        /// Encodes the content into writer, which must have packed_size() bytes left
+        void pack_into(essential::SpanWriter<std::endian::little> &writer) const noexcept;
         [[nodiscard]] Block pack(int32_t id, pmr::MemoryResource *memory) const;
-        [[nodiscard]] static Headers unpack(const Block& block, pmr::MemoryResource *memory);
+        [[nodiscard]] static Headers unpack(
+                const Block& block, pmr::MemoryResource *memory,
+                int32_t max_count = std::numeric_limits<int32_t>::max()
+        );
     private:
-        alias::unordered_map <alias::string, alias::string, string_hash, std::equal_to<>> m_table;
+        alias::unordered_map <alias::string, alias::string, detail::StringHash, std::equal_to<>> m_table;
     };
 
     struct Request {
         RequestLine line;
         Headers headers;
         Block body;
+        /// Further body blocks in order, for bodies too large for a single block
+        std::vector<Block> continuation{};
+
+        /// A deep copy, including the body and every continuation block
+        [[nodiscard]] Request clone(pmr::MemoryResource *memory) const;
     };
 
     struct Response {
         ResponseLine line;
         Headers headers;
         Block body;
+        /// Further body blocks in order, for bodies too large for a single block
+        std::vector<Block> continuation{};
+
+        /// A deep copy, including the body and every continuation block
+        [[nodiscard]] Response clone(pmr::MemoryResource *memory) const;
     };
 }
\ No newline at end of file
@@ -22,6 +22,12 @@
 
 #pragma once
 
+#include <map>
+#include <span>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <vector>
 #include "Message.h"
 #include "kls/coroutine/Async.h"
 
@@ -30,10 +36,51 @@ namespace kls::phttp {
         [[nodiscard]] const char *what() const noexcept override;
     };
 
+    struct ClientOptions {
+        /// <summary>
+        /// When set, a request identical to one already in flight (same verb, resource, coalescing headers and body)
+        /// is not sent again. It is attached to the in-flight request and receives a copy of its response.
+        /// Every attached request gets its own line and headers, while the body blocks are shared by reference count
+        /// with the other requests of the flight and must only be read. Only enable this for idempotent requests.
+        /// </summary>
+        bool coalesce{false};
+        /// Header names that take part in the coalescing key
+        std::vector<std::string> coalesce_headers{};
+        /// Receives messages pushed by the server. It runs on the receiving coroutine and should return quickly.
+        std::function<void(Request)> on_push{};
+    };
+
     struct ClientEndpoint: public PmrBase {
         virtual coroutine::ValueAsync<Response> exec(Request request) = 0;
+        /// <summary>
+        /// Sends all requests with a single write. Each returned task completes when its response arrives.
+        /// The requests are moved from and are never coalesced.
+        /// </summary>
+        virtual coroutine::ValueAsync<std::vector<coroutine::ValueAsync<Response>>> exec_batch(
+                std::span<Request> requests
+        ) = 0;
+        /// Sends a one-way message. The server handles it but never replies.
+        virtual coroutine::ValueAsync<> notify(Request request) = 0;
         virtual coroutine::ValueAsync<> close() = 0;
-        static std::unique_ptr<ClientEndpoint> create(std::unique_ptr<Endpoint> ep);
+        static std::unique_ptr<ClientEndpoint> create(std::unique_ptr<Endpoint> ep, ClientOptions options = {});
+    };
+
+    enum class Execution {
+        /// Handlers are moved to another worker before they run
+        Redispatch,
+        /// Handlers run on the receiving coroutine until they first suspend. Blocks receiving while they run.
+        Inline,
+        /// Handlers run inline while the recent run time for their resource stays within the inline budget
+        Adaptive
+    };
+
+    struct ServerOptions {
+        Execution execution{Execution::Redispatch};
+        /// Execution policies for individual resources, overriding execution
+        std::map<std::string, Execution, std::less<>> routes{};
+        /// Adaptive resources are redispatched once the moving average of their handler wall time exceeds this.
+        /// The time is taken from the start of the handler to its completion, including time spent suspended.
+        std::chrono::nanoseconds inline_budget{std::chrono::microseconds(20)};
     };
 
     class ServerEndpoint: public PmrBase {
@@ -47,12 +94,30 @@ namespace kls::phttp {
             m_trivial = [](Request &&request, void *data) { return (*static_cast<Fn *>(data))(std::move(request)); };
             co_await run();
         }
+        /// Like run(handler), but one-way messages are given to notified instead of to handler
+        template<class Fn, class Nf>
+        requires requires(Fn fn, Nf nf, Request request) {
+            { fn(std::move(request)) } -> std::same_as<coroutine::ValueAsync<Response>>;
+            { nf(std::move(request)) } -> std::same_as<coroutine::ValueAsync<>>;
+        }
+        coroutine::ValueAsync<void> run(Fn handler, Nf notified) {
+            m_notified_data = &notified;
+            m_notified_trivial = [](Request &&request, void *data) {
+                return (*static_cast<Nf *>(data))(std::move(request));
+            };
+            co_await run(std::move(handler));
+        }
+        /// Pushes a one-way message to the client, delivered to ClientOptions::on_push
+        virtual coroutine::ValueAsync<> push(Request message) = 0;
         virtual coroutine::ValueAsync<> close() = 0;
-        static std::unique_ptr<ServerEndpoint> create(std::unique_ptr<Endpoint> ep);
+        static std::unique_ptr<ServerEndpoint> create(std::unique_ptr<Endpoint> ep, ServerOptions options = {});
     protected:
         using Trivial = coroutine::ValueAsync<Response>(*)(Request &&, void *);
+        using NotifiedTrivial = coroutine::ValueAsync<>(*)(Request &&, void *);
         void *m_data{};
         Trivial m_trivial{};
+        void *m_notified_data{};
+        NotifiedTrivial m_notified_trivial{};
         virtual coroutine::ValueAsync<void> run() = 0;
     };
 }
\ No newline at end of file
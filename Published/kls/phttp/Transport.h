@@ -22,6 +22,12 @@
 
 #pragma once
 
+#include <limits>
+#include <memory>
+#include <vector>
+#include <ranges>
+#include <optional>
+#include <algorithm>
 #include "kls/io/IP.h"
 #include "kls/pmr/Automatic.h"
 #include "kls/coroutine/Async.h"
@@ -30,8 +36,9 @@
 
 namespace kls::phttp {
     class Block {
+        [[nodiscard]] char *data() const noexcept { return m_v ? m_v.get() : m_shared.get(); }
         [[nodiscard]] auto header() const noexcept {
-            return essential::Access<std::endian::little>{{m_v.get(), 8}};
+            return essential::Access<std::endian::little>{{data(), 8}};
         }
     public:
         Block() noexcept: m_v(nullptr) {}
@@ -50,15 +57,165 @@ namespace kls::phttp {
         void set_id(int32_t value) noexcept { header().put<int32_t>(0, value); }
         [[nodiscard]] int32_t id() const noexcept { return header().get<int32_t>(0); }
         [[nodiscard]] int32_t size() const noexcept { return header().get<int32_t>(4); }
-        [[nodiscard]] Span<> bytes() const noexcept { return {m_v.get(), size() + 8}; }
-        [[nodiscard]] Span<> content() const noexcept { return {m_v.get() + 8, size()}; }
+        [[nodiscard]] Span<> bytes() const noexcept { return {data(), size() + 8}; }
+        [[nodiscard]] Span<> content() const noexcept { return {data() + 8, size()}; }
+        [[nodiscard]] Block clone(pmr::MemoryResource *resource) const {
+            if (!data()) return {};
+            auto result = Block(size(), id(), resource);
+            const auto source = content();
+            std::copy(source.begin(), source.end(), result.content().begin());
+            return result;
+        }
+        /// Another block over the same bytes without copying them. The storage is then shared by reference count
+        /// and must only be read, through either block
+        [[nodiscard]] Block share() {
+            if (m_v) m_shared = std::shared_ptr<char[]>(std::move(m_v));
+            Block result{};
+            result.m_shared = m_shared;
+            return result;
+        }
     private:
         pmr::unique_ptr<char[]> m_v;
+        std::shared_ptr<char[]> m_shared{};
+    };
+
+    /// <summary>
+    /// Contiguous output buffer of a connection. Blocks are encoded in place one after another so that a whole
+    /// message goes out in a single vectored write where the platform has one. Large contents can be referenced
+    /// instead of copied, those must stay valid until the buffer has been put. Clearing the buffer keeps its
+    /// capacity for the next message.
+    /// </summary>
+    class OutputBuffer {
+    public:
+        struct Entry {
+            int32_t id;
+            Span<> content;
+        };
+
+        explicit OutputBuffer(pmr::MemoryResource *memory = pmr::default_resource()) noexcept:
+                m_memory(memory), m_buffer(nullptr) {}
+        OutputBuffer(OutputBuffer&&) noexcept = default;
+        OutputBuffer& operator=(OutputBuffer&&) noexcept = default;
+
+        /// Appends a block with the given content size and returns a writer over the content.
+        /// The writer is valid until the next append
+        [[nodiscard]] essential::SpanWriter<std::endian::little> append(int32_t id, int32_t size);
+        /// Appends a block with the content encoded by part.pack_into
+        template<class T>
+        void append_packed(int32_t id, const T &part) {
+            auto writer = append(id, part.packed_size());
+            part.pack_into(writer);
+        }
+        /// Appends a block whose content is referenced in place
+        void append_slice(int32_t id, Span<> content);
+        void clear() noexcept;
+        [[nodiscard]] bool empty() const noexcept { return m_entries.empty(); }
+        /// The appended blocks in order, as a view valid until the next change to the buffer
+        [[nodiscard]] auto blocks() const noexcept {
+            return std::views::transform(m_entries, [base = m_buffer.get()](const Record &entry) {
+                return Entry{.id = entry.id, .content = {entry.borrowed ? entry.borrowed : base + entry.offset, entry.size}};
+            });
+        }
+        /// The bytes to put on the wire in order, alternating runs of the buffer and referenced contents, as a view
+        /// valid until the next change to the buffer
+        [[nodiscard]] auto chunks() const noexcept {
+            return std::views::transform(m_chunks, [this](const Chunk &chunk) {
+                if (chunk.borrowed) return Span<>{chunk.borrowed, ptrdiff_t(chunk.end)};
+                const auto end = chunk.end == open_run ? m_size : chunk.end;
+                return Span<>{m_buffer.get() + chunk.begin, ptrdiff_t(end - chunk.begin)};
+            });
+        }
+    private:
+        struct Record {
+            int32_t id;
+            int32_t size;
+            // offset of the content in the buffer, or of the header alone if the content is referenced
+            size_t offset;
+            char *borrowed;
+        };
+
+        // a run of the buffer from begin to end, or a referenced content of end bytes
+        struct Chunk {
+            size_t begin;
+            size_t end;
+            char *borrowed;
+        };
+
+        // end of the last run, which grows with the buffer
+        static constexpr size_t open_run = std::numeric_limits<size_t>::max();
+
+        pmr::MemoryResource *m_memory;
+        pmr::unique_ptr<char[]> m_buffer;
+        size_t m_size{0}, m_capacity{0};
+        // both keep their capacity when cleared, so a connection settles on no allocations per message
+        std::vector<Record> m_entries{};
+        std::vector<Chunk> m_chunks{};
+
+        char *grow(size_t size);
+    };
+
+    struct Limits {
+        /// Largest block content accepted from the peer, in bytes. Bodies are fragmented on the wire, so this only
+        /// needs to hold a fragment or the encoded line and headers of a message
+        int32_t max_block_size{4 * 1024 * 1024};
+        /// Largest number of header entries accepted in one message
+        int32_t max_header_count{4096};
+        /// Largest body accepted in one message after its fragments are joined, in bytes
+        int64_t max_body_size{64 * 1024 * 1024};
+        /// Largest data block sent, larger bodies are split and interleaved with other messages on the connection
+        /// This must not exceed the max_block_size of the peer
+        int32_t fragment_size{256 * 1024};
+        /// Largest number of messages received in part at the same time, fragmented bodies stay partial the longest
+        size_t max_staged_messages{1024};
+    };
+
+    /// <summary>
+    /// Options applied to every TCP socket of a connection. The defaults favour latency of small request/response
+    /// exchanges. A value of 0 keeps the system default. Options not supported by the platform are ignored.
+    /// </summary>
+    struct SocketOptions {
+        /// TCP_NODELAY, sends small blocks at once instead of waiting to coalesce them
+        bool no_delay{true};
+        /// TCP_QUICKACK, re-armed after every received block as the system clears it
+        bool quick_ack{false};
+        /// SO_SNDBUF and SO_RCVBUF in bytes, raise these for bulk transfers over high-latency links
+        int32_t send_buffer{0};
+        int32_t receive_buffer{0};
+        /// SO_BUSY_POLL in microseconds
+        int32_t busy_poll{0};
+        /// TCP_USER_TIMEOUT in milliseconds, how long sent data may stay unacknowledged before the connection drops
+        int32_t user_timeout{0};
+        /// SO_KEEPALIVE together with TCP_KEEPIDLE and TCP_KEEPINTVL in seconds and TCP_KEEPCNT
+        bool keep_alive{false};
+        int32_t keep_alive_idle{0};
+        int32_t keep_alive_interval{0};
+        int32_t keep_alive_count{0};
+    };
+
+    struct TransportOptions {
+        Limits limits{};
+        SocketOptions socket{};
     };
 
     struct Endpoint : PmrBase {
         [[nodiscard]] virtual io::Peer peer() const noexcept = 0;
+        [[nodiscard]] virtual const Limits &limits() const noexcept {
+            static constexpr Limits defaults{};
+            return defaults;
+        }
+        /// The socket options in effect as reported by the system, empty if the endpoint is not a socket
+        [[nodiscard]] virtual std::optional<SocketOptions> socket_options() const { return std::nullopt; }
         [[nodiscard]] virtual coroutine::ValueAsync<> put(Block) = 0;
+        /// Puts a block with the given id and content, the content is only borrowed until completion
+        [[nodiscard]] virtual coroutine::ValueAsync<> put_slice(int32_t id, Span<> content) {
+            auto block = Block(int32_t(content.end() - content.begin()), id, pmr::default_resource());
+            std::copy(content.begin(), content.end(), block.content().begin());
+            co_await put(std::move(block));
+        }
+        /// Puts every block of the buffer in order, the buffer is only borrowed until completion
+        [[nodiscard]] virtual coroutine::ValueAsync<> put_buffer(const OutputBuffer &buffer) {
+            for (auto &&block: buffer.blocks()) co_await put_slice(block.id, block.content);
+        }
         [[nodiscard]] virtual coroutine::ValueAsync <Block> get() = 0;
         [[nodiscard]] virtual coroutine::ValueAsync<> close() = 0;
     };
@@ -68,6 +225,8 @@ namespace kls::phttp {
         [[nodiscard]] virtual coroutine::ValueAsync<> close() = 0;
     };
 
-    [[nodiscard]] std::unique_ptr<Host> listen_tcp(io::Peer local, int backlog);
-    [[nodiscard]] coroutine::ValueAsync <std::unique_ptr<Endpoint>> connect_tcp(io::Peer peer);
+    [[nodiscard]] std::unique_ptr<Host> listen_tcp(io::Peer local, int backlog, TransportOptions options = {});
+    [[nodiscard]] coroutine::ValueAsync <std::unique_ptr<Endpoint>> connect_tcp(
+            io::Peer peer, TransportOptions options = {}
+    );
 }
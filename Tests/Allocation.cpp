@@ -0,0 +1,85 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <gtest/gtest.h>
+#include "kls/phttp/Protocol.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+#include "../Module/FramePool.h"
+#include "EchoServer.h"
+
+using namespace kls::io;
+using namespace kls::phttp;
+using namespace kls::essential;
+using namespace kls::coroutine;
+
+// the global heap is replaced for the whole test binary, allocations are only counted while a measurement runs
+static std::atomic_bool Counting{false};
+static std::atomic<int64_t> Allocations{0};
+
+void *operator new(size_t size) {
+    if (Counting.load(std::memory_order_relaxed)) Allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto memory = std::malloc(size ? size : 1); memory) return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+
+static constexpr int WarmUp = 2000;
+static constexpr int Measured = 10000;
+static size_t PoolMisses{0};
+
+static ValueAsync<void> EchoOnce(ClientEndpoint &ep) {
+    auto memory = kls::pmr::default_resource();
+    auto response = co_await ep.exec(Request{
+            .line = RequestLine("ECHO", "/"), .headers = Headers(), .body = ResponseLine(200, "OK").pack(0, memory)
+    });
+    if (response.line.code() != 200) throw std::runtime_error("Echo Response Check Failure");
+}
+
+static ValueAsync<void> ClientRepeated() {
+    auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33090}));
+    co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<void> {
+        for (int i = 0; i < WarmUp; ++i) co_await EchoOnce(ep);
+        const auto misses = detail::FramePool::fresh_allocations();
+        Counting = true;
+        for (int i = 0; i < Measured; ++i) co_await EchoOnce(ep);
+        Counting = false;
+        PoolMisses = detail::FramePool::fresh_allocations() - misses;
+    });
+}
+
+TEST(kls_phttp, AllocationFramePool) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33090), ClientRepeated());
+    });
+    std::printf("%.2f allocations per echo, %zu frames missed the pool\n",
+                double(Allocations.load()) / Measured, PoolMisses);
+    // frames released on the other side of a connection go back to their pool, so the pools stay warm
+    ASSERT_LT(PoolMisses, size_t(Measured / 100));
+}
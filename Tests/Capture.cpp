@@ -0,0 +1,149 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include "kls/phttp/Capture.h"
+#include "kls/phttp/Protocol.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+#include "EchoServer.h"
+
+using namespace kls::io;
+using namespace kls::phttp;
+using namespace kls::coroutine;
+using Clock = std::chrono::steady_clock;
+
+static std::atomic_int ReplayHandled{0};
+
+static ValueAsync<Response> CountingEcho(Request request) {
+    ++ReplayHandled;
+    return Echo(std::move(request));
+}
+
+// sends four echo requests through a capturing client, spaced by gap
+static ValueAsync<void> ClientCaptured(std::string path, int port, std::chrono::milliseconds gap = {}) {
+    auto endpoint = co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), port});
+    auto client = ClientEndpoint::create(capture(std::move(endpoint), path));
+    co_await uses(client, [gap](ClientEndpoint &ep) -> ValueAsync<> {
+        for (int32_t i = 0; i < 4; ++i) {
+            if (i) std::this_thread::sleep_for(gap);
+            auto memory = kls::pmr::default_resource();
+            auto request = Request{
+                    .line = RequestLine("ECHO", "/"),
+                    .headers = Headers(),
+                    .body = ResponseLine(i, "OK").pack(0, memory)
+            };
+            (void) co_await ep.exec(std::move(request));
+        }
+    });
+}
+
+static std::string CapturePath(const char *name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+TEST(kls_phttp, CaptureReplay) {
+    const auto path = CapturePath("kls_phttp_capture.bin");
+    ReplayHandled = 0;
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33082, CountingEcho), ClientCaptured(path, 33082));
+    });
+    ASSERT_EQ(ReplayHandled.load(), 4);
+    {
+        auto file = open_capture(path);
+        int outbound = 0, inbound = 0;
+        for (auto &&record: file->records()) {
+            if (record.id < 0) continue;
+            ++(record.direction == Direction::Outbound ? outbound : inbound);
+        }
+        // line, headers and body of every request and response
+        ASSERT_EQ(outbound, 12);
+        ASSERT_EQ(inbound, 12);
+        run_blocking([&]() -> ValueAsync<void> {
+            auto server = ServerEndpoint::create(replay_endpoint(*file, Direction::Outbound, ReplaySpeed::Maximum));
+            co_await uses(server, [](ServerEndpoint &ep) -> ValueAsync<> { co_await ep.run(CountingEcho); });
+        });
+    }
+    std::filesystem::remove(path);
+    ASSERT_EQ(ReplayHandled.load(), 8);
+}
+
+TEST(kls_phttp, CaptureReplayOriginalSpeed) {
+    const auto path = CapturePath("kls_phttp_capture_paced.bin");
+    ReplayHandled = 0;
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(
+                ServeOnce(33095, CountingEcho), ClientCaptured(path, 33095, std::chrono::milliseconds(20))
+        );
+    });
+    Clock::duration span{}, elapsed{};
+    {
+        auto file = open_capture(path);
+        std::vector<std::chrono::nanoseconds> times{};
+        for (auto &&record: file->records()) {
+            if (record.direction == Direction::Outbound && record.id >= 0) times.push_back(record.time);
+        }
+        span = std::chrono::duration_cast<Clock::duration>(times.back() - times.front());
+        const auto start = Clock::now();
+        run_blocking([&]() -> ValueAsync<void> {
+            auto server = ServerEndpoint::create(replay_endpoint(*file, Direction::Outbound, ReplaySpeed::Original));
+            co_await uses(server, [](ServerEndpoint &ep) -> ValueAsync<> { co_await ep.run(CountingEcho); });
+        });
+        elapsed = Clock::now() - start;
+    }
+    std::filesystem::remove(path);
+    ASSERT_EQ(ReplayHandled.load(), 8);
+    // the three gaps between requests are kept, a replay at maximum speed would take next to no time
+    ASSERT_GT(span, std::chrono::milliseconds(60));
+    ASSERT_TRUE(elapsed >= span);
+}
+
+TEST(kls_phttp, CaptureReplayAsClient) {
+    const auto path = CapturePath("kls_phttp_capture_client.bin");
+    ReplayHandled = 0;
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33096, CountingEcho), ClientCaptured(path, 33096));
+    });
+    ReplayResult result{};
+    {
+        auto file = open_capture(path);
+        run_blocking([&]() -> ValueAsync<void> {
+            auto client = [&]() -> ValueAsync<void> {
+                auto target = co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33097});
+                co_await uses(target, [&](Endpoint &ep) -> ValueAsync<> {
+                    result = co_await replay(*file, Direction::Outbound, ep, ReplaySpeed::Original);
+                });
+            };
+            co_await kls::coroutine::awaits(ServeOnce(33097, CountingEcho), client());
+        });
+    }
+    std::filesystem::remove(path);
+    // the four requests are served again and the line, headers and body of their responses come back
+    ASSERT_EQ(ReplayHandled.load(), 8);
+    ASSERT_EQ(result.sent, 12);
+    ASSERT_EQ(result.received, 12);
+}
@@ -0,0 +1,81 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <gtest/gtest.h>
+#include "kls/phttp/Codec.h"
+
+namespace {
+    enum class Kind : uint16_t { Foo = 1, Bar = 0x1234 };
+
+    struct Fixed {
+        int32_t id;
+        Kind kind;
+        double weight;
+        uint64_t stamp;
+    };
+
+    struct Mixed {
+        int64_t id;
+        std::string name;
+        float ratio;
+        std::string note;
+    };
+}
+
+template<>
+struct kls::phttp::CodecFields<Fixed> {
+    static constexpr auto fields = std::tuple{&Fixed::id, &Fixed::kind, &Fixed::weight, &Fixed::stamp};
+};
+
+template<>
+struct kls::phttp::CodecFields<Mixed> {
+    static constexpr auto fields = std::tuple{&Mixed::id, &Mixed::name, &Mixed::ratio, &Mixed::note};
+};
+
+TEST(kls_phttp, CodecFixed) {
+    using namespace kls::phttp;
+    static_assert(Codec<Fixed>::is_fixed && Codec<Fixed>::fixed_size == 22);
+    auto raw = Fixed{.id = -42, .kind = Kind::Bar, .weight = 0.5, .stamp = 0x0102030405060708ull};
+    auto packed = Codec<Fixed>::encode(raw);
+    ASSERT_EQ(packed.size(), 22);
+    auto trip = Codec<Fixed>::decode(packed);
+    auto result = (trip.id == raw.id) && (trip.kind == raw.kind) && (trip.weight == raw.weight) &&
+                  (trip.stamp == raw.stamp);
+    ASSERT_TRUE(result);
+    auto view = Codec<Fixed>::View(packed);
+    auto in_place = (view.get<&Fixed::kind>() == raw.kind) && (view.get<&Fixed::stamp>() == raw.stamp);
+    ASSERT_TRUE(in_place);
+}
+
+TEST(kls_phttp, CodecMixed) {
+    using namespace kls::phttp;
+    static_assert(!Codec<Mixed>::is_fixed);
+    auto raw = Mixed{.id = 7, .name = "phttp", .ratio = 1.25f, .note = ""};
+    auto packed = Codec<Mixed>::encode(raw);
+    ASSERT_EQ(packed.size(), Codec<Mixed>::size(raw));
+    auto trip = Codec<Mixed>::decode(packed);
+    auto result = (trip.id == raw.id) && (trip.name == raw.name) && (trip.ratio == raw.ratio) &&
+                  (trip.note == raw.note);
+    ASSERT_TRUE(result);
+    ASSERT_EQ(Codec<Mixed>::View(packed).get<&Mixed::id>(), raw.id);
+}
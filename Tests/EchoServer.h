@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include "kls/phttp/Protocol.h"
+#include "kls/coroutine/Operation.h"
+
+// echoes the headers and body of the request back with a 200 line
+inline kls::coroutine::ValueAsync<kls::phttp::Response> Echo(kls::phttp::Request request) {
+    co_return kls::phttp::Response{
+            .line = kls::phttp::ResponseLine(200, "OK"),
+            .headers = std::move(request.headers),
+            .body = std::move(request.body),
+            .continuation = std::move(request.continuation)
+    };
+}
+
+// accepts a single connection on port and serves it with handler until the client shuts it down
+template<class Fn = decltype(&Echo)>
+kls::coroutine::ValueAsync<void> ServeOnce(
+        int port, Fn handler = &Echo, kls::phttp::ServerOptions options = {}, kls::phttp::TransportOptions transport = {}
+) {
+    using namespace kls::phttp;
+    using namespace kls::coroutine;
+    auto host = listen_tcp({kls::io::Address::CreateIPv4("0.0.0.0").value(), port}, 128, transport);
+    co_await uses(host, [&](Host &host) -> ValueAsync<> {
+        auto peer = ServerEndpoint::create(co_await host.accept(), std::move(options));
+        co_await uses(peer, [&](ServerEndpoint &ep) -> ValueAsync<> { co_await ep.run(std::move(handler)); });
+    });
+}
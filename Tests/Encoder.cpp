@@ -21,7 +21,10 @@
 */
 
 #include <string>
+#include <algorithm>
+#include <string_view>
 #include <gtest/gtest.h>
+#include "kls/phttp/Error.h"
 #include "kls/phttp/Message.h"
 
 TEST(kls_phttp, EncodeRequestLine) {
@@ -33,6 +36,23 @@ TEST(kls_phttp, EncodeRequestLine) {
     ASSERT_TRUE(result);
 }
 
+TEST(kls_phttp, CloneRequestKeepsVersion) {
+    using namespace kls::phttp;
+    auto memory = kls::pmr::default_resource();
+    auto packed = RequestLine("POST", "TEST_RESOURCE/A").pack(0, memory);
+    // a peer speaking a later version than the one this side writes
+    const auto content = packed.content();
+    const auto version = std::string_view("PHTTP/1.0");
+    const auto at = std::search(content.begin(), content.end(), version.begin(), version.end());
+    ASSERT_TRUE(at != content.end());
+    *(at + int(version.size()) - 1) = '1';
+    auto request = Request{.line = RequestLine::unpack(packed, memory), .headers = Headers(memory), .body = {}};
+    auto copy = request.clone(memory);
+    auto result = (copy.line.version() == "PHTTP/1.1") && (copy.line.verb() == "POST") &&
+                  (copy.line.resource() == "TEST_RESOURCE/A");
+    ASSERT_TRUE(result);
+}
+
 TEST(kls_phttp, EncodeResponseLine) {
     using namespace kls::phttp;
     auto raw = ResponseLine(20000, "SUCCESS");
@@ -52,3 +72,49 @@ TEST(kls_phttp, EncodeHeaders) {
     auto result = (trip.get("Test") == raw.get("Test")) && (trip.get("Foo") == raw.get("Foo"));
     ASSERT_TRUE(result);
 }
+
+TEST(kls_phttp, DecodeMalformed) {
+    using namespace kls::phttp;
+    auto memory = kls::pmr::default_resource();
+    auto oversized = RequestLine("POST", "TEST_RESOURCE/A").pack(0, memory);
+    oversized.content().begin()[0] = 0x7f;
+    ASSERT_THROW((void) RequestLine::unpack(oversized, memory), MalformedBlock);
+    auto negative = ResponseLine(20000, "SUCCESS").pack(0, memory);
+    negative.content().begin()[7] = char(0x80);
+    ASSERT_THROW((void) ResponseLine::unpack(negative, memory), MalformedBlock);
+    auto raw = Headers();
+    raw.set("Test", "Headers");
+    raw.set("Foo", "Bar");
+    auto packed = raw.pack(0, memory);
+    ASSERT_THROW((void) Headers::unpack(packed, memory, 1), MalformedBlock);
+    packed.content().begin()[0] = 3;
+    ASSERT_THROW((void) Headers::unpack(packed, memory), MalformedBlock);
+}
+
+TEST(kls_phttp, EncodeOutputBuffer) {
+    using namespace kls::phttp;
+    auto memory = kls::pmr::default_resource();
+    auto line = RequestLine("POST", "TEST_RESOURCE/A");
+    auto headers = Headers();
+    headers.set("Test", "Headers");
+    auto body = ResponseLine(20000, "SUCCESS").pack(7, memory);
+    auto buffer = OutputBuffer();
+    buffer.append_packed(7, line);
+    buffer.append_packed(7, headers);
+    buffer.append_slice(7, body.content());
+    buffer.append_packed(8, line);
+    // the wire bytes are the same as those of the blocks packed on their own
+    std::string expected{}, wire{};
+    for (auto &&block: {line.pack(7, memory), headers.pack(7, memory), body.clone(memory), line.pack(8, memory)}) {
+        const auto bytes = block.bytes();
+        expected.append(bytes.begin(), bytes.end());
+    }
+    for (auto &&chunk: buffer.chunks()) wire.append(chunk.begin(), chunk.end());
+    ASSERT_EQ(wire, expected);
+    const auto blocks = buffer.blocks();
+    ASSERT_EQ(blocks.size(), 4);
+    ASSERT_EQ(blocks[2].content.begin(), body.content().begin());
+    ASSERT_EQ(blocks[3].id, 8);
+    buffer.clear();
+    ASSERT_TRUE(buffer.empty());
+}
@@ -0,0 +1,76 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <thread>
+#include <gtest/gtest.h>
+#include "kls/phttp/Hedging.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+#include "EchoServer.h"
+
+using namespace kls::io;
+using namespace kls::phttp;
+using namespace kls::coroutine;
+
+static HedgingStats HedgedStats{};
+
+template<int DelayMs>
+static ValueAsync<Response> DelayedEcho(Request request) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(DelayMs));
+    return Echo(std::move(request));
+}
+
+static ValueAsync<void> ClientHedged() {
+    std::vector<std::unique_ptr<ClientEndpoint>> peers{};
+    peers.push_back(ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33083})));
+    peers.push_back(ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33084})));
+    auto options = HedgingOptions{.initial_delay = std::chrono::milliseconds(5), .max_hedge_ratio = 1.0};
+    auto client = HedgingClient::create(std::move(peers), std::move(options));
+    auto result = co_await uses(client, [](HedgingClient &ep) -> ValueAsync<bool> {
+        auto memory = kls::pmr::default_resource();
+        bool success = true;
+        // every other request goes to the slow peer first, then the POST goes there and is never hedged
+        for (auto verb: {"GET", "GET", "GET", "GET", "POST"}) {
+            const auto code = int32_t(ep.stats().requests);
+            auto request = Request{
+                    .line = RequestLine(verb, "/"),
+                    .headers = Headers(),
+                    .body = ResponseLine(code, "OK").pack(0, memory)
+            };
+            auto response = co_await ep.exec(std::move(request));
+            success = success && ResponseLine::unpack(response.body, memory).code() == code;
+        }
+        HedgedStats = ep.stats();
+        co_return success;
+    });
+    if (!result) throw std::runtime_error("Hedged Echo Content Check Failure");
+}
+
+TEST(kls_phttp, HedgingSlowPeer) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33083, DelayedEcho<200>), ServeOnce(33084, DelayedEcho<0>), ClientHedged());
+    });
+    ASSERT_EQ(HedgedStats.requests, 5);
+    ASSERT_GT(HedgedStats.hedged, 1);
+    ASSERT_LT(HedgedStats.hedged, 5);
+    ASSERT_EQ(HedgedStats.hedge_wins, 2);
+}
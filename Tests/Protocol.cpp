@@ -20,33 +20,22 @@
 * SOFTWARE.
 */
 
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <gtest/gtest.h>
+#include "kls/phttp/Error.h"
 #include "kls/phttp/Protocol.h"
 #include "kls/coroutine/Blocking.h"
 #include "kls/coroutine/Operation.h"
+#include "EchoServer.h"
 
 using namespace kls::io;
 using namespace kls::phttp;
 using namespace kls::essential;
 using namespace kls::coroutine;
 
-static ValueAsync<void> ServerOnceEcho() {
-    auto host = listen_tcp({Address::CreateIPv4("0.0.0.0").value(), 33080}, 128);
-    co_await uses(host, [](Host &host) -> ValueAsync<> {
-        auto peer = ServerEndpoint::create(co_await host.accept());
-        co_await uses(peer, [](ServerEndpoint &ep)-> ValueAsync<> {
-            co_await ep.run([](Request request) -> ValueAsync<Response> {
-                co_return Response {
-                        .line = ResponseLine(200, "OK"),
-                        .headers = std::move(request.headers),
-                        .body = std::move(request.body)
-                };
-            });
-        });
-    });
-};
-
 static ValueAsync<void> ClientOnce() {
     auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33080}));
     auto result = co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<bool> {
@@ -66,6 +55,305 @@ static ValueAsync<void> ClientOnce() {
 
 TEST(kls_phttp, ProtocolEcho) {
     run_blocking([&]() -> ValueAsync<void> {
-        co_await kls::coroutine::awaits(ServerOnceEcho(), ClientOnce());
+        co_await kls::coroutine::awaits(ServeOnce(33080), ClientOnce());
+    });
+}
+
+static std::atomic_int CoalescedHandled{0};
+
+static ValueAsync<Response> CountingEcho(Request request) {
+    ++CoalescedHandled;
+    return Echo(std::move(request));
+}
+
+static ValueAsync<void> ClientCoalesced() {
+    auto endpoint = co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33081});
+    auto client = ClientEndpoint::create(std::move(endpoint), ClientOptions{.coalesce = true});
+    auto result = co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<bool> {
+        auto memory = kls::pmr::default_resource();
+        auto raw = ResponseLine(20000, "OK");
+        auto request = [&]() {
+            return Request{.line = RequestLine("GET", "/"), .headers = Headers(), .body = raw.pack(0, memory)};
+        };
+        auto first = ep.exec(request()), second = ep.exec(request()), third = ep.exec(request());
+        bool success = true;
+        std::vector<Response> responses{};
+        for (auto *exec: {&first, &second, &third}) {
+            auto response = co_await std::move(*exec);
+            auto trip = ResponseLine::unpack(response.body, memory);
+            success = success && (trip.code() == raw.code()) && (trip.message() == raw.message());
+            responses.push_back(std::move(response));
+        }
+        // the body is shared by the whole flight rather than copied per follower
+        for (auto &&response: responses)
+            success = success && response.body.content().begin() == responses.front().body.content().begin();
+        co_return success;
+    });
+    if (!result) throw std::runtime_error("Coalesced Echo Content Check Failure");
+}
+
+TEST(kls_phttp, ProtocolCoalescing) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33081, CountingEcho), ClientCoalesced());
+    });
+    ASSERT_EQ(CoalescedHandled.load(), 1);
+}
+
+static ValueAsync<void> ClientBatch() {
+    auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33080}));
+    auto result = co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<bool> {
+        auto memory = kls::pmr::default_resource();
+        std::vector<Request> requests{};
+        for (int32_t i = 0; i < 8; ++i) {
+            auto raw = ResponseLine(i, "OK");
+            requests.push_back(Request{.line = RequestLine("ECHO", "/"), .headers = Headers(), .body = raw.pack(0, memory)});
+        }
+        auto responses = co_await ep.exec_batch(requests);
+        bool success = responses.size() == 8;
+        for (int32_t i = 0; i < int32_t(responses.size()); ++i) {
+            auto response = co_await std::move(responses[i]);
+            auto trip = ResponseLine::unpack(response.body, memory);
+            success = success && (trip.code() == i) && (trip.message() == "OK");
+        }
+        co_return success;
     });
-}
\ No newline at end of file
+    if (!result) throw std::runtime_error("Batched Echo Content Check Failure");
+}
+
+TEST(kls_phttp, ProtocolBatch) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33080), ClientBatch());
+    });
+}
+
+static Block Pattern(int32_t size, int32_t seed) {
+    auto block = Block(size, kls::pmr::default_resource());
+    int32_t i = 0;
+    for (auto &&c: block.content()) c = char((i++ * 31 + seed) & 0xff);
+    return block;
+}
+
+static std::string Concat(const Block &body, const std::vector<Block> &continuation) {
+    std::string result(body.content().begin(), body.content().end());
+    for (auto &&block: continuation) result.append(block.content().begin(), block.content().end());
+    return result;
+}
+
+static ValueAsync<void> ClientFragmented() {
+    auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33085}));
+    auto result = co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<bool> {
+        // a body several fragments long
+        auto large = Pattern(1024 * 1024 + 123, 1);
+        auto expect_large = Concat(large, {});
+        auto first = co_await ep.exec(Request{.line = RequestLine("ECHO", "/"), .headers = Headers(), .body = std::move(large)});
+        // a body supplied through continuation blocks, one of them larger than a fragment
+        auto request = Request{.line = RequestLine("ECHO", "/"), .headers = Headers(), .body = Pattern(1000, 2)};
+        request.continuation.push_back(Pattern(300 * 1024, 3));
+        request.continuation.push_back(Pattern(10, 4));
+        auto expect_continued = Concat(request.body, request.continuation);
+        auto second = co_await ep.exec(std::move(request));
+        // fragments are joined again, so readers of the body alone see all of it
+        co_return first.continuation.empty() && second.continuation.empty() &&
+                  Concat(first.body, first.continuation) == expect_large &&
+                  Concat(second.body, second.continuation) == expect_continued;
+    });
+    if (!result) throw std::runtime_error("Fragmented Echo Content Check Failure");
+}
+
+TEST(kls_phttp, ProtocolFragmentation) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33085), ClientFragmented());
+    });
+}
+
+static std::atomic_bool LargeDone{false};
+
+static ValueAsync<bool> ExecLarge(ClientEndpoint &ep, int32_t size) {
+    auto body = Pattern(size, 5);
+    auto expect = Concat(body, {});
+    auto response = co_await ep.exec(Request{.line = RequestLine("ECHO", "/"), .headers = Headers(), .body = std::move(body)});
+    LargeDone = true;
+    co_return Concat(response.body, response.continuation) == expect;
+}
+
+static ValueAsync<void> ClientInterleaved() {
+    auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33086}));
+    auto result = co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<bool> {
+        auto large = ExecLarge(ep, 32 * 1024 * 1024);
+        auto small = co_await ep.exec(Request{.line = RequestLine("ECHO", "/"), .headers = Headers(), .body = Pattern(16, 6)});
+        // the small exchange fits between two fragments of the large one and completes first
+        const bool overtaken = !LargeDone;
+        const bool large_intact = co_await std::move(large);
+        co_return overtaken && large_intact && Concat(small.body, small.continuation) == Concat(Pattern(16, 6), {});
+    });
+    if (!result) throw std::runtime_error("Interleaved Echo Check Failure");
+}
+
+TEST(kls_phttp, ProtocolInterleaving) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(33086), ClientInterleaved());
+    });
+}
+
+static std::atomic_bool OversizedRejected{false};
+
+static ValueAsync<void> ServeLimited() {
+    try {
+        auto limits = Limits{.max_body_size = 64 * 1024};
+        co_await ServeOnce(33087, &Echo, ServerOptions{}, TransportOptions{.limits = limits});
+    }
+    catch (MalformedBlock &) { OversizedRejected = true; }
+}
+
+static ValueAsync<void> ClientOversized() {
+    auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33087}));
+    bool failed = false;
+    try {
+        co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<void> {
+            co_await ep.exec(Request{.line = RequestLine("ECHO", "/"), .headers = Headers(), .body = Pattern(1024 * 1024, 7)});
+        });
+    }
+    catch (...) { failed = true; }
+    if (!failed) throw std::runtime_error("Oversized Body Accepted");
+}
+
+TEST(kls_phttp, ProtocolMaxBodySize) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeLimited(), ClientOversized());
+    });
+    ASSERT_TRUE(OversizedRejected.load());
+}
+
+static std::atomic_bool StagingRejected{false};
+
+static ValueAsync<void> ServeStagingLimited() {
+    try {
+        auto limits = Limits{.max_staged_messages = 4};
+        co_await ServeOnce(33094, &Echo, ServerOptions{}, TransportOptions{.limits = limits});
+    }
+    catch (MalformedBlock &) { StagingRejected = true; }
+}
+
+// opens messages whose bodies never finish, more of them than the server stages
+static ValueAsync<void> ClientNeverFinishing() {
+    auto file = co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33094});
+    try {
+        co_await uses(file, [](Endpoint &ep) -> ValueAsync<void> {
+            auto memory = kls::pmr::default_resource();
+            for (int32_t id = 1; id <= 8; ++id) {
+                co_await ep.put(RequestLine("ECHO", "/").pack(id, memory));
+                co_await ep.put(Headers().pack(id, memory));
+                auto fragment = Pattern(16, id);
+                fragment.set_id(id | 0x20000000);
+                co_await ep.put(std::move(fragment));
+            }
+            (void) co_await ep.get();
+        });
+    }
+    catch (...) {}
+}
+
+TEST(kls_phttp, ProtocolMaxStagedMessages) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeStagingLimited(), ClientNeverFinishing());
+    });
+    ASSERT_TRUE(StagingRejected.load());
+}
+
+static std::atomic_int Notified{0};
+static std::atomic_bool Pushed{false};
+static ServerEndpoint *PushingServer{nullptr};
+
+static ValueAsync<> CountNotified(Request) {
+    ++Notified;
+    co_return;
+}
+
+// pushes a message to the client ahead of every response
+static ValueAsync<Response> PushingEcho(Request request) {
+    co_await PushingServer->push(Request{.line = RequestLine("PUSH", "/"), .headers = Headers(), .body = Pattern(8, 8)});
+    co_return co_await Echo(std::move(request));
+}
+
+static ValueAsync<void> ServeNotified() {
+    auto host = listen_tcp({Address::CreateIPv4("0.0.0.0").value(), 33088}, 128);
+    co_await uses(host, [](Host &host) -> ValueAsync<> {
+        auto peer = ServerEndpoint::create(co_await host.accept());
+        co_await uses(peer, [](ServerEndpoint &ep) -> ValueAsync<> {
+            PushingServer = &ep;
+            co_await ep.run(&PushingEcho, &CountNotified);
+        });
+    });
+}
+
+static ValueAsync<void> ClientNotifying() {
+    auto endpoint = co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33088});
+    auto options = ClientOptions{.on_push = [](Request request) { Pushed = request.line.verb() == "PUSH"; }};
+    auto client = ClientEndpoint::create(std::move(endpoint), std::move(options));
+    auto result = co_await uses(client, [](ClientEndpoint &ep) -> ValueAsync<bool> {
+        co_await ep.notify(Request{.line = RequestLine("NOTE", "/"), .headers = Headers(), .body = Pattern(8, 9)});
+        co_await ep.notify(Request{.line = RequestLine("NOTE", "/"), .headers = Headers(), .body = Pattern(8, 10)});
+        // the push is received before the response it precedes
+        auto response = co_await ep.exec(Request{.line = RequestLine("ECHO", "/"), .headers = Headers(), .body = Pattern(8, 11)});
+        co_return Pushed.load() && Concat(response.body, response.continuation) == Concat(Pattern(8, 11), {});
+    });
+    if (!result) throw std::runtime_error("Push Check Failure");
+}
+
+TEST(kls_phttp, ProtocolNotifyAndPush) {
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeNotified(), ClientNotifying());
+    });
+    // the server joins every running handler before it returns
+    ASSERT_EQ(Notified.load(), 2);
+}
+
+static std::atomic_int InFlight{0};
+static std::atomic_int MaxInFlight{0};
+
+// blocks its worker for a while and records how many handlers ran at once
+static ValueAsync<Response> SlowEcho(Request request) {
+    const auto running = ++InFlight;
+    for (auto seen = MaxInFlight.load(); seen < running && !MaxInFlight.compare_exchange_weak(seen, running);) {}
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    --InFlight;
+    return Echo(std::move(request));
+}
+
+static ValueAsync<void> ClientSlowBatch(int port, bool warm_up) {
+    auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), port}));
+    co_await uses(client, [warm_up](ClientEndpoint &ep) -> ValueAsync<void> {
+        auto request = []() {
+            return Request{.line = RequestLine("GET", "/slow"), .headers = Headers(), .body = Pattern(8, 12)};
+        };
+        if (warm_up) co_await ep.exec(request());
+        std::vector<Request> requests{};
+        for (int i = 0; i < 4; ++i) requests.push_back(request());
+        auto responses = co_await ep.exec_batch(requests);
+        for (auto &&response: responses) co_await std::move(response);
+    });
+}
+
+static int MaxConcurrentSlowHandlers(int port, ServerOptions options, bool warm_up = false) {
+    InFlight = 0;
+    MaxInFlight = 0;
+    run_blocking([&]() -> ValueAsync<void> {
+        co_await kls::coroutine::awaits(ServeOnce(port, SlowEcho, std::move(options)), ClientSlowBatch(port, warm_up));
+    });
+    return MaxInFlight.load();
+}
+
+TEST(kls_phttp, ProtocolExecutionInline) {
+    ASSERT_EQ(MaxConcurrentSlowHandlers(33091, ServerOptions{.execution = Execution::Inline}), 1);
+}
+
+TEST(kls_phttp, ProtocolExecutionRouteOverride) {
+    auto options = ServerOptions{.execution = Execution::Inline, .routes = {{"/slow", Execution::Redispatch}}};
+    ASSERT_GT(MaxConcurrentSlowHandlers(33092, std::move(options)), 1);
+}
+
+TEST(kls_phttp, ProtocolExecutionAdaptive) {
+    // the first request runs inline and its run time puts the resource over budget, the batch is then redispatched
+    auto options = ServerOptions{.execution = Execution::Adaptive, .inline_budget = std::chrono::milliseconds(1)};
+    ASSERT_GT(MaxConcurrentSlowHandlers(33093, std::move(options), true), 1);
+}
@@ -21,6 +21,7 @@
 */
 
 #include <string>
+#include <optional>
 #include <gtest/gtest.h>
 #include "kls/phttp/Message.h"
 #include "kls/coroutine/Blocking.h"
@@ -59,4 +60,37 @@ TEST(kls_phttp, TransportTcpEcho) {
         //co_await kls::coroutine::awaits(std::move(server), std::move(client));
         co_await std::move(server), co_await std::move(client);
     });
-}
\ No newline at end of file
+}
+
+static const auto TunedSocket = SocketOptions{.no_delay = false, .keep_alive = true};
+
+static ValueAsync<> ServerOnceTuned() {
+    auto host = listen_tcp({Address::CreateIPv4("0.0.0.0").value(), 33089}, 128, TransportOptions{.socket = TunedSocket});
+    co_await uses(host, [](Host &host) -> ValueAsync<> {
+        auto peer = co_await host.accept();
+        co_await uses(peer, [](Endpoint &ep) -> ValueAsync<> { co_await ep.put(co_await ep.get()); });
+    });
+}
+
+static ValueAsync<std::optional<SocketOptions>> ClientOnceTuned() {
+    auto file = co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), 33089}, TransportOptions{.socket = TunedSocket});
+    co_return co_await uses(file, [](Endpoint &ep) -> ValueAsync<std::optional<SocketOptions>> {
+        auto memory = kls::pmr::default_resource();
+        co_await ep.put(ResponseLine(200, "OK").pack(0, memory));
+        (void) co_await ep.get();
+        co_return ep.socket_options();
+    });
+}
+
+TEST(kls_phttp, TransportSocketOptions) {
+    std::optional<SocketOptions> applied{};
+    run_blocking([&]() -> ValueAsync<void> {
+        auto server = ServerOnceTuned();
+        auto client = ClientOnceTuned();
+        applied = co_await std::move(client);
+        co_await std::move(server);
+    });
+    ASSERT_TRUE(applied.has_value());
+    ASSERT_FALSE(applied->no_delay);
+    ASSERT_TRUE(applied->keep_alive);
+}
@@ -0,0 +1,110 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+// phttp-alloc-bench: global heap allocations per steady-state RPC over a loopback connection
+//
+// The global operator new is replaced for the whole binary and only counts while a measurement runs. Each body size
+// is echoed a number of times untimed first, so that frame pools and recycled table nodes are warm when counting.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include "kls/phttp/Protocol.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+#include "../Module/FramePool.h"
+
+using namespace kls::io;
+using namespace kls::phttp;
+using namespace kls::coroutine;
+
+static std::atomic_bool Counting{false};
+static std::atomic<int64_t> Allocations{0};
+
+void *operator new(size_t size) {
+    if (Counting.load(std::memory_order_relaxed)) Allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto memory = std::malloc(size ? size : 1); memory) return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+
+namespace {
+    constexpr int Port = 33091;
+    constexpr int32_t BodySizes[] = {0, 64, 4096, 1 << 20};
+
+    ValueAsync<> echo_server(Host &host) {
+        auto peer = ServerEndpoint::create(co_await host.accept(), ServerOptions{.execution = Execution::Inline});
+        co_await uses(peer, [](ServerEndpoint &ep) -> ValueAsync<> {
+            co_await ep.run([](Request request) -> ValueAsync<Response> {
+                co_return Response{
+                        .line = ResponseLine(200, "OK"),
+                        .headers = std::move(request.headers),
+                        .body = std::move(request.body),
+                        .continuation = std::move(request.continuation)
+                };
+            });
+        });
+    }
+
+    ValueAsync<> echo_repeated(ClientEndpoint &client, int32_t body_size, int count) {
+        auto memory = kls::pmr::default_resource();
+        for (int i = 0; i < count; ++i) {
+            auto body = Block(body_size, 0, memory);
+            const auto content = body.content();
+            std::fill(content.begin(), content.end(), char(0));
+            auto response = co_await client.exec(Request{
+                    .line = RequestLine("ECHO", "/"), .headers = Headers(), .body = std::move(body)
+            });
+            if (response.line.code() != 200) throw std::runtime_error("Echo Response Check Failure");
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const auto iterations = std::max(argc > 1 ? std::atoi(argv[1]) : 10000, 1);
+    std::printf("%-10s %14s %12s\n", "body", "allocs/rpc", "pool misses");
+    run_blocking([&]() -> ValueAsync<> {
+        auto host = listen_tcp({Address::CreateIPv4("0.0.0.0").value(), Port}, 128);
+        auto server = echo_server(*host);
+        auto client = ClientEndpoint::create(co_await connect_tcp({Address::CreateIPv4("127.0.0.1").value(), Port}));
+        for (const auto size: BodySizes) {
+            co_await echo_repeated(*client, size, iterations / 5 + 1);
+            const auto misses = detail::FramePool::fresh_allocations();
+            Allocations = 0;
+            Counting = true;
+            co_await echo_repeated(*client, size, iterations);
+            Counting = false;
+            // the request body built by the caller is one of the counted allocations
+            std::printf("%-10d %14.2f %12zu\n", size, double(Allocations.load()) / iterations,
+                        detail::FramePool::fresh_allocations() - misses);
+        }
+        co_await client->close();
+        co_await std::move(server);
+        co_await host->close();
+    });
+    return 0;
+}
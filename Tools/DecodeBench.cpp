@@ -0,0 +1,102 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+// phttp-decode-bench: cost of the bounds-checked decoders against unchecked decoding of the same blocks
+//
+// The unchecked decoders below read lengths and counts as they come, like the decoders did before every length was
+// validated against the remaining content. They are only safe on trusted input and exist here as the baseline.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <cstdlib>
+#include <string_view>
+#include "kls/phttp/Message.h"
+
+using namespace kls::phttp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    using Reader = kls::essential::SpanReader<std::endian::little>;
+
+    std::string_view unchecked_string(Reader &reader) {
+        const auto length = reader.get<int32_t>();
+        const auto span = reader.bytes(length);
+        return {span.begin(), span.end()};
+    }
+
+    RequestLine unchecked_request_line(const Block &block, kls::pmr::MemoryResource *memory) {
+        Reader reader{block.content()};
+        const auto verb = unchecked_string(reader);
+        (void) unchecked_string(reader);
+        const auto resource = unchecked_string(reader);
+        return {verb, resource, memory};
+    }
+
+    Headers unchecked_headers(const Block &block, kls::pmr::MemoryResource *memory) {
+        Headers result{memory};
+        Reader reader{block.content()};
+        const auto count = reader.get<int32_t>();
+        for (int32_t i = 0; i < count; ++i) {
+            const auto key = unchecked_string(reader);
+            result.set(key, unchecked_string(reader));
+        }
+        return result;
+    }
+
+    template<class Fn>
+    double measure(size_t iterations, Fn &&fn) {
+        size_t sink = 0;
+        const auto start = Clock::now();
+        for (size_t i = 0; i < iterations; ++i) sink += fn();
+        const auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (sink == 0) std::puts("");
+        return elapsed / double(iterations);
+    }
+
+    void report(const char *name, double checked, double unchecked) {
+        std::printf("%-16s %14.1f %14.1f %+9.1f%%\n", name, checked, unchecked, (checked / unchecked - 1.0) * 100.0);
+    }
+}
+
+int main(int argc, char **argv) {
+    const auto iterations = size_t(argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000);
+    auto memory = kls::pmr::default_resource();
+    const auto line = RequestLine("POST", "/service/resource/with/a/longer/path").pack(0, memory);
+    auto source = Headers(memory);
+    for (int i = 0; i < 16; ++i) source.set("X-Header-" + std::to_string(i), "value of header " + std::to_string(i));
+    const auto headers = source.pack(0, memory);
+
+    std::printf("%-16s %14s %14s %10s\n", "decoder", "checked(ns)", "unchecked(ns)", "overhead");
+    // each decoder runs once untimed so both sides start warm
+    const auto line_checked = [&]() { return RequestLine::unpack(line, memory).resource().size(); };
+    const auto line_unchecked = [&]() { return unchecked_request_line(line, memory).resource().size(); };
+    (void) measure(iterations / 10 + 1, line_checked);
+    (void) measure(iterations / 10 + 1, line_unchecked);
+    report("RequestLine", measure(iterations, line_checked), measure(iterations, line_unchecked));
+    const auto headers_checked = [&]() { return Headers::unpack(headers, memory).get("X-Header-7").size(); };
+    const auto headers_unchecked = [&]() { return unchecked_headers(headers, memory).get("X-Header-7").size(); };
+    (void) measure(iterations / 10 + 1, headers_checked);
+    (void) measure(iterations / 10 + 1, headers_unchecked);
+    report("Headers(16)", measure(iterations, headers_checked), measure(iterations, headers_unchecked));
+    return 0;
+}
@@ -0,0 +1,355 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+// phttp-load: closed- and open-loop load generator for phttp services
+//
+// Closed loop keeps a fixed number of requests in flight on every connection and measures each request from when
+// it was sent. Open loop sends at a fixed rate regardless of completions and measures each request from when it was
+// scheduled to be sent, so that stalls of the service are not hidden by the generator backing off (coordinated
+// omission). Without --target an echo server is started in-process.
+
+#include <bit>
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include "kls/phttp/Protocol.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Future.h"
+#include "kls/coroutine/Operation.h"
+#include "../Module/Timer.h"
+
+using namespace kls::io;
+using namespace kls::phttp;
+using namespace kls::coroutine;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    struct RequestKind {
+        std::string verb{"ECHO"};
+        std::string resource{"/"};
+        int32_t body_size{64};
+        double weight{1.0};
+    };
+
+    struct Config {
+        std::string host{"127.0.0.1"};
+        int port{33090};
+        bool in_process{true};
+        bool open_loop{false};
+        int connections{4};
+        int concurrency{16};
+        double rate{10000.0};
+        double duration{10.0};
+        std::vector<RequestKind> mix{};
+        std::vector<std::pair<std::string, std::string>> headers{};
+    };
+
+    // log-linear histogram in the spirit of HdrHistogram, values in nanoseconds with 3 significant digits
+    class Histogram {
+        static constexpr int sub_bits = 11;
+        static constexpr uint64_t sub_count = uint64_t(1) << sub_bits;
+        static constexpr int magnitudes = 64 - sub_bits + 1;
+
+        static size_t index_of(uint64_t value) noexcept {
+            const int magnitude = std::max(0, int(std::bit_width(value)) - sub_bits);
+            return size_t(magnitude) * sub_count + size_t(value >> magnitude);
+        }
+
+        static uint64_t value_of(size_t index) noexcept {
+            const auto magnitude = index / sub_count, sub = index % sub_count;
+            // upper bound of the bucket so that reported percentiles never understate
+            return ((sub + 1) << magnitude) - 1;
+        }
+    public:
+        Histogram() : m_counts(size_t(magnitudes) * sub_count) {}
+
+        void record(Clock::duration latency) noexcept {
+            const auto value = uint64_t(std::max<int64_t>(0, latency.count()));
+            m_counts[index_of(value)].fetch_add(1, std::memory_order_relaxed);
+            m_total.fetch_add(1, std::memory_order_relaxed);
+            m_sum.fetch_add(value, std::memory_order_relaxed);
+            for (auto max = m_max.load(); value > max && !m_max.compare_exchange_weak(max, value););
+        }
+
+        [[nodiscard]] uint64_t total() const noexcept { return m_total.load(); }
+        [[nodiscard]] uint64_t max() const noexcept { return m_max.load(); }
+        [[nodiscard]] double mean() const noexcept { return total() ? double(m_sum.load()) / double(total()) : 0.0; }
+
+        [[nodiscard]] uint64_t percentile(double percent) const noexcept {
+            const auto target = std::max<uint64_t>(1, uint64_t(percent / 100.0 * double(total()) + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < m_counts.size(); ++i) {
+                if ((seen += m_counts[i].load(std::memory_order_relaxed)) >= target) return std::min(value_of(i), max());
+            }
+            return max();
+        }
+    private:
+        std::vector<std::atomic<uint64_t>> m_counts;
+        std::atomic<uint64_t> m_total{0}, m_sum{0}, m_max{0};
+    };
+
+    struct Stats {
+        Histogram latency{};
+        std::atomic<uint64_t> errors{0};
+    };
+
+    class RequestFactory {
+    public:
+        explicit RequestFactory(const Config &config) : m_config(config) {
+            double total = 0.0;
+            for (auto &&kind: config.mix) m_cumulative.push_back(total += kind.weight);
+        }
+
+        // shared by every worker, so the pick only reads the precomputed cumulative weights
+        Request make(std::mt19937_64 &random) const {
+            const auto point = std::uniform_real_distribution<double>(0.0, m_cumulative.back())(random);
+            const auto pick = std::upper_bound(m_cumulative.begin(), m_cumulative.end(), point) - m_cumulative.begin();
+            const auto &kind = m_config.mix[std::min(size_t(pick), m_config.mix.size() - 1)];
+            auto memory = kls::pmr::default_resource();
+            auto request = Request{
+                    .line = RequestLine(kind.verb, kind.resource, memory),
+                    .headers = Headers(memory),
+                    .body = Block(kind.body_size, 0, memory)
+            };
+            for (auto &&[key, value]: m_config.headers) request.headers.set(key, value);
+            const auto content = request.body.content();
+            std::fill(content.begin(), content.end(), char(0));
+            return request;
+        }
+    private:
+        const Config &m_config;
+        std::vector<double> m_cumulative{};
+    };
+
+    ValueAsync<> echo_server(Host &host, int connections) {
+        std::vector<ValueAsync<>> sessions{};
+        for (int i = 0; i < connections; ++i) {
+            auto peer = ServerEndpoint::create(co_await host.accept(), ServerOptions{.execution = Execution::Inline});
+            sessions.push_back(uses(peer, [](ServerEndpoint &ep) -> ValueAsync<> {
+                co_await ep.run([](Request request) -> ValueAsync<Response> {
+                    co_return Response{
+                            .line = ResponseLine(200, "OK"),
+                            .headers = std::move(request.headers),
+                            .body = std::move(request.body),
+                            .continuation = std::move(request.continuation)
+                    };
+                });
+            }));
+        }
+        for (auto &&session: sessions) co_await std::move(session);
+    }
+
+    ValueAsync<> closed_worker(ClientEndpoint &client, const RequestFactory &factory, Stats &stats,
+                               Clock::time_point end, uint64_t seed) {
+        auto random = std::mt19937_64(seed);
+        while (Clock::now() < end) {
+            auto request = factory.make(random);
+            const auto start = Clock::now();
+            try {
+                (void) co_await client.exec(std::move(request));
+                stats.latency.record(Clock::now() - start);
+            }
+            catch (...) { ++stats.errors; }
+        }
+    }
+
+    // open loop requests in flight, each erases its own entry when done so that memory stays flat over long runs
+    struct InFlight {
+        std::mutex lock{};
+        std::unordered_map<uint64_t, ValueAsync<>> tasks{};
+    };
+
+    ValueAsync<> timed_request(ClientEndpoint &client, Request request, Stats &stats, Clock::time_point intended,
+                               InFlight &flight, uint64_t key) {
+        try {
+            (void) co_await client.exec(std::move(request));
+            stats.latency.record(Clock::now() - intended);
+        }
+        catch (...) { ++stats.errors; }
+        std::lock_guard lk{flight.lock};
+        flight.tasks.erase(key);
+    }
+
+    // a request that completes before it is stored has already erased its reserved entry and is not stored
+    void start_timed_request(ClientEndpoint &client, Request request, Stats &stats, Clock::time_point intended,
+                             InFlight &flight, uint64_t key) {
+        {
+            std::lock_guard lk{flight.lock};
+            flight.tasks.insert({key, ValueAsync<>{}});
+        }
+        auto handle = timed_request(client, std::move(request), stats, intended, flight, key);
+        std::lock_guard lk{flight.lock};
+        if (auto it = flight.tasks.find(key); it != flight.tasks.end()) it->second = std::move(handle);
+    }
+
+    // requests are issued at their intended times no matter how many are still outstanding. each is built ahead
+    // of its slot so that building it is not measured, and the wait for the slot is left to the timer thread so
+    // that no executor thread, which responses also resume on, is held while pacing
+    ValueAsync<> open_loop(std::vector<std::unique_ptr<ClientEndpoint>> &clients, const RequestFactory &factory,
+                           Stats &stats, const Config &config, Clock::time_point start) {
+        auto random = std::mt19937_64(std::random_device{}());
+        const auto interval = std::chrono::duration<double>(1.0 / config.rate);
+        const auto total = uint64_t(config.rate * config.duration);
+        kls::phttp::detail::Timer timer{};
+        InFlight flight{};
+        for (uint64_t i = 0; i < total; ++i) {
+            const auto intended = start + std::chrono::duration_cast<Clock::duration>(interval * double(i));
+            auto request = factory.make(random);
+            if (intended > Clock::now()) {
+                co_await ValueFuture<void>([&](auto promise) {
+                    timer.schedule(intended, [promise]() { promise->set(); });
+                });
+                co_await Redispatch{};
+            }
+            start_timed_request(*clients[i % clients.size()], std::move(request), stats, intended, flight, i);
+        }
+        decltype(flight.tasks) remaining{};
+        {
+            std::lock_guard lk{flight.lock};
+            remaining = std::move(flight.tasks);
+        }
+        for (auto &&[key, task]: remaining) co_await std::move(task);
+    }
+
+    void report(const Config &config, const Stats &stats, Clock::duration elapsed) {
+        const auto seconds = std::chrono::duration<double>(elapsed).count();
+        const auto &latency = stats.latency;
+        std::printf("mode: %s, connections: %d, ", config.open_loop ? "open" : "closed", config.connections);
+        if (config.open_loop) std::printf("rate: %.0f/s\n", config.rate);
+        else std::printf("concurrency: %d per connection\n", config.concurrency);
+        std::printf("requests: %llu, errors: %llu, elapsed: %.3fs, throughput: %.1f/s\n",
+                    (unsigned long long) latency.total(), (unsigned long long) stats.errors.load(), seconds,
+                    double(latency.total()) / seconds);
+        if (!latency.total()) return;
+        std::printf("latency mean: %.3fus, max: %.3fus\n", latency.mean() / 1e3, double(latency.max()) / 1e3);
+        std::printf("%14s %14s %12s\n", "Value(us)", "Percentile", "1/(1-P)");
+        for (double remain = 50.0; remain >= 0.001; remain /= 2) {
+            const auto percent = 100.0 - remain;
+            std::printf("%14.3f %14.6f %12.2f\n", double(latency.percentile(percent)) / 1e3, percent / 100.0,
+                        100.0 / remain);
+        }
+        std::printf("%14.3f %14.6f %12s\n", double(latency.max()) / 1e3, 1.0, "inf");
+    }
+
+    void usage() {
+        std::puts(
+                "usage: phttp-load [options]\n"
+                "  --target HOST:PORT          load an existing IPv4 service instead of the in-process echo server\n"
+                "  --port PORT                 port of the in-process echo server (default 33090)\n"
+                "  --open RATE                 open loop at RATE requests/s, measured from intended send time\n"
+                "  --closed CONCURRENCY        closed loop with CONCURRENCY requests in flight per connection\n"
+                "  --connections N             number of connections (default 4)\n"
+                "  --duration SECONDS          length of the run (default 10)\n"
+                "  --request VERB RES SIZE W   add a request kind with body SIZE bytes and weight W to the mix\n"
+                "  --header KEY=VALUE          header sent with every request"
+        );
+    }
+
+    bool parse(int argc, char **argv, Config &config) {
+        for (int i = 1; i < argc; ++i) {
+            const auto arg = std::string_view(argv[i]);
+            const auto has = [&](int count) { return i + count < argc; };
+            if (arg == "--target" && has(1)) {
+                const auto target = std::string_view(argv[++i]);
+                const auto colon = target.rfind(':');
+                if (colon == std::string_view::npos) return false;
+                config.host = std::string(target.substr(0, colon));
+                config.port = std::stoi(std::string(target.substr(colon + 1)));
+                config.in_process = false;
+            }
+            else if (arg == "--port" && has(1)) config.port = std::stoi(argv[++i]);
+            else if (arg == "--open" && has(1)) config.open_loop = true, config.rate = std::stod(argv[++i]);
+            else if (arg == "--closed" && has(1)) config.open_loop = false, config.concurrency = std::stoi(argv[++i]);
+            else if (arg == "--connections" && has(1)) config.connections = std::stoi(argv[++i]);
+            else if (arg == "--duration" && has(1)) config.duration = std::stod(argv[++i]);
+            else if (arg == "--request" && has(4)) {
+                config.mix.push_back(RequestKind{
+                        .verb = argv[i + 1], .resource = argv[i + 2],
+                        .body_size = std::stoi(argv[i + 3]), .weight = std::stod(argv[i + 4])
+                });
+                i += 4;
+            }
+            else if (arg == "--header" && has(1)) {
+                const auto header = std::string_view(argv[++i]);
+                const auto equal = header.find('=');
+                if (equal == std::string_view::npos) return false;
+                config.headers.emplace_back(header.substr(0, equal), header.substr(equal + 1));
+            }
+            else return false;
+        }
+        if (config.mix.empty()) config.mix.push_back(RequestKind{});
+        return config.connections > 0 && config.concurrency > 0 && config.rate > 0 && config.duration > 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    Config config{};
+    try {
+        if (!parse(argc, argv, config)) return usage(), 1;
+    }
+    catch (std::exception &) { return usage(), 1; }
+    const auto factory = RequestFactory(config);
+    Stats stats{};
+    Clock::duration elapsed{};
+    run_blocking([&]() -> ValueAsync<> {
+        std::unique_ptr<Host> host{};
+        ValueAsync<> server{};
+        if (config.in_process) {
+            host = listen_tcp({Address::CreateIPv4("0.0.0.0").value(), config.port}, 128);
+            server = echo_server(*host, config.connections);
+        }
+        const auto peer = Peer{Address::CreateIPv4(config.host).value(), config.port};
+        std::vector<std::unique_ptr<ClientEndpoint>> clients{};
+        for (int i = 0; i < config.connections; ++i) clients.push_back(ClientEndpoint::create(co_await connect_tcp(peer)));
+        const auto start = Clock::now();
+        if (config.open_loop) co_await open_loop(clients, factory, stats, config, start);
+        else {
+            const auto end = start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(config.duration)
+            );
+            std::vector<ValueAsync<>> workers{};
+            uint64_t seed = std::random_device{}();
+            for (auto &&client: clients) {
+                for (int i = 0; i < config.concurrency; ++i)
+                    workers.push_back(closed_worker(*client, factory, stats, end, seed++));
+            }
+            for (auto &&worker: workers) co_await std::move(worker);
+        }
+        elapsed = Clock::now() - start;
+        for (auto &&client: clients) co_await client->close();
+        if (config.in_process) {
+            co_await std::move(server);
+            co_await host->close();
+        }
+    });
+    report(config, stats, elapsed);
+    return 0;
+}